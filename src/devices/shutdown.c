@@ -12,11 +12,16 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "userprog/syscall.h"
 #endif
 #ifdef VM
 #include "vm/swap.h"
 #include "vm/frame.h"
+#include "vm/share.h"
 #endif
 
 /* Keyboard control register port. */
@@ -133,10 +138,19 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  inode_print_stats ();
+  dcache_print_stats ();
+  journal_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  frame_print_stats ();
+  share_print_stats ();
+  swap_print_stats ();
+#endif
 }
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -24,7 +25,50 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Timer wheel.
+
+   Pending timeouts are hashed into WHEEL_LEVELS levels of
+   WHEEL_SIZE slots each.  A timeout due within WHEEL_SIZE ticks
+   goes into level 0, in the slot for its exact tick; one due
+   later goes into the slot of the lowest level whose range
+   covers it, where each slot of level L spans WHEEL_SIZE**L
+   ticks.  Each tick runs the timeouts in one level-0 slot, and
+   whenever the level-0 index wraps around, the next slot of
+   level 1 is cascaded down, and so on up the levels.  Arming
+   and canceling are thus O(1), and a tick costs O(1) plus the
+   timeouts that expire, plus occasional cascades that touch
+   each timeout at most once per level.
+
+   Timeouts due beyond the top level's range are parked in its
+   last slot and cascaded back up until they come within range.
+
+   The wheel is shared with timer_interrupt(), so it is only
+   touched with interrupts off.  Tests may create wheels of their
+   own, which they drive themselves. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+struct timer_wheel
+  {
+    struct list slots[WHEEL_LEVELS][WHEEL_SIZE];
+    int64_t tick;               /* Next tick whose level-0 slot is to
+                                   be run. */
+    long long fired_cnt;        /* # of timeouts run. */
+    long long cascade_cnt;      /* # of timeouts moved down a level. */
+  };
+
+/* The wheel driven by the timer interrupt. */
+static struct timer_wheel wheel;
+
 static intr_handler_func timer_interrupt;
+static void wheel_init (struct timer_wheel *, int64_t tick);
+static void wheel_arm (struct timer_wheel *, struct timeout *,
+                       int64_t ticks);
+static void wheel_insert (struct timer_wheel *, struct timeout *);
+static void run_wheel (struct timer_wheel *);
+static timeout_func wake_sleeper;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -35,6 +79,8 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  wheel_init (&wheel, ticks + 1);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -89,11 +135,27 @@ timer_elapsed (int64_t then)
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct timeout timeout;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  /* Interrupts stay off until we are blocked so that the timeout
+     cannot try to wake us while we are still running. */
+  timeout_init (&timeout, wake_sleeper, thread_current ());
+  old_level = intr_disable ();
+  timeout_arm (&timeout, ticks);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Wakes up the thread T_ sleeping in timer_sleep(). */
+static void
+wake_sleeper (void *t_)
+{
+  thread_unblock (t_);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -164,6 +226,67 @@ void
 timer_print_stats (void) 
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  printf ("Timer: %lld timeouts run, %lld cascaded\n",
+          wheel.fired_cnt, wheel.cascade_cnt);
+}
+
+/* Initializes TIMEOUT to call FUNC, passing AUX, when it
+   expires.  It is not armed. */
+void
+timeout_init (struct timeout *timeout, timeout_func *func, void *aux)
+{
+  ASSERT (timeout != NULL);
+  ASSERT (func != NULL);
+
+  timeout->func = func;
+  timeout->aux = aux;
+  timeout->pending = false;
+}
+
+/* Arms TIMEOUT to expire TICKS timer ticks from now, or at the
+   next tick if TICKS is not positive.  If TIMEOUT is already
+   pending, it is moved to the new time.
+
+   TIMEOUT's function will run in the timer interrupt handler, so
+   it must not sleep.  It may arm or cancel timeouts, including
+   its own.  TIMEOUT must stay in existence until it expires or
+   is canceled.
+
+   This function may be called from an interrupt handler. */
+void
+timeout_arm (struct timeout *timeout, int64_t ticks)
+{
+  enum intr_level old_level;
+
+  ASSERT (timeout != NULL);
+
+  old_level = intr_disable ();
+  wheel_arm (&wheel, timeout, ticks);
+  intr_set_level (old_level);
+}
+
+/* Cancels TIMEOUT, if it is pending.  Returns true if it was,
+   false if it already expired or was never armed.
+
+   This function may be called from an interrupt handler. */
+bool
+timeout_cancel (struct timeout *timeout)
+{
+  enum intr_level old_level;
+  bool was_pending;
+
+  ASSERT (timeout != NULL);
+
+  old_level = intr_disable ();
+  was_pending = timeout->pending;
+  if (was_pending)
+    {
+      list_remove (&timeout->elem);
+      timeout->pending = false;
+    }
+  intr_set_level (old_level);
+
+  return was_pending;
 }
 
 /* Timer interrupt handler. */
@@ -171,9 +294,185 @@ static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
+  ASSERT (wheel.tick == ticks);
+  run_wheel (&wheel);
   thread_tick ();
 }
 
+/* Creates a timer wheel whose next tick to run is TICK, for a
+   test to drive with timer_wheel_advance() instead of the timer
+   interrupt.  Returns a null pointer if memory is short. */
+struct timer_wheel *
+timer_wheel_create (int64_t tick)
+{
+  struct timer_wheel *w = malloc (sizeof *w);
+  if (w != NULL)
+    wheel_init (w, tick);
+  return w;
+}
+
+/* Frees W, which must have no timeouts pending. */
+void
+timer_wheel_destroy (struct timer_wheel *w)
+{
+  free (w);
+}
+
+/* Like timeout_arm(), but arms TIMEOUT on W instead of on the
+   wheel driven by the timer interrupt. */
+void
+timer_wheel_arm (struct timer_wheel *w, struct timeout *timeout,
+                 int64_t ticks)
+{
+  enum intr_level old_level;
+
+  ASSERT (w != NULL);
+  ASSERT (timeout != NULL);
+
+  old_level = intr_disable ();
+  wheel_arm (w, timeout, ticks);
+  intr_set_level (old_level);
+}
+
+/* Returns the last tick that W has run, the counterpart of
+   timer_ticks() for timeouts armed on W. */
+int64_t
+timer_wheel_now (const struct timer_wheel *w)
+{
+  return w->tick - 1;
+}
+
+/* Runs W through TICKS ticks, running the timeouts that expire
+   and cascading as the timer interrupt would.  A stretch of ticks
+   with nothing due in level 0 is skipped to the next tick that
+   cascades, since nothing could happen before it. */
+void
+timer_wheel_advance (struct timer_wheel *w, int64_t ticks)
+{
+  int64_t end = w->tick + ticks;
+
+  ASSERT (w != NULL && w != &wheel);
+
+  while (w->tick < end)
+    {
+      enum intr_level old_level = intr_disable ();
+      int64_t next = ROUND_UP (w->tick + 1, WHEEL_SIZE);
+      int idx;
+
+      for (idx = w->tick & WHEEL_MASK; idx < WHEEL_SIZE; idx++)
+        if (!list_empty (&w->slots[0][idx]))
+          break;
+      if ((w->tick & WHEEL_MASK) != 0 && idx == WHEEL_SIZE)
+        w->tick = next < end ? next : end;
+      else
+        run_wheel (w);
+      intr_set_level (old_level);
+    }
+}
+
+/* Initializes W, with TICK the next tick to run. */
+static void
+wheel_init (struct timer_wheel *w, int64_t tick)
+{
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&w->slots[level][slot]);
+  w->tick = tick;
+  w->fired_cnt = w->cascade_cnt = 0;
+}
+
+/* Arms TIMEOUT on W to expire TICKS ticks after the last one W
+   ran, moving it if it is already pending.  Interrupts must be
+   off. */
+static void
+wheel_arm (struct timer_wheel *w, struct timeout *timeout, int64_t ticks)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (timeout->pending)
+    list_remove (&timeout->elem);
+  timeout->expires = w->tick + (ticks > 0 ? ticks : 1) - 1;
+  timeout->pending = true;
+  wheel_insert (w, timeout);
+}
+
+/* Puts pending TIMEOUT into W's slot for its expiry time,
+   relative to W's next tick.  Interrupts must be off. */
+static void
+wheel_insert (struct timer_wheel *w, struct timeout *timeout)
+{
+  int64_t delta = timeout->expires - w->tick;
+  int64_t expires = timeout->expires;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (delta < 0)
+    expires = w->tick;
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+    expires = w->tick + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  list_push_back (&w->slots[level][(expires >> (WHEEL_BITS * level))
+                                   & WHEEL_MASK],
+                  &timeout->elem);
+}
+
+/* Runs the timeouts on W that expire at its next tick, first
+   cascading down the higher-level slots that have come due, and
+   moves on to the tick after.  Interrupts must be off. */
+static void
+run_wheel (struct timer_wheel *w)
+{
+  struct list expired;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Cascade.  Level L's slot is due whenever the indexes of all
+     the levels below it wrap around to 0. */
+  for (level = 1; level < WHEEL_LEVELS; level++)
+    {
+      struct list *slot;
+
+      if (((w->tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK) != 0)
+        break;
+      slot = &w->slots[level][(w->tick >> (WHEEL_BITS * level))
+                              & WHEEL_MASK];
+      while (!list_empty (slot))
+        {
+          struct timeout *t = list_entry (list_pop_front (slot),
+                                          struct timeout, elem);
+          wheel_insert (w, t);
+          w->cascade_cnt++;
+        }
+    }
+
+  /* Take this tick's timeouts off the wheel before running any of
+     them, so that those they arm for the next tick land in a
+     slot that is not being run. */
+  list_init (&expired);
+  while (!list_empty (&w->slots[0][w->tick & WHEEL_MASK]))
+    list_push_back (&expired,
+                    list_pop_front (&w->slots[0][w->tick & WHEEL_MASK]));
+  w->tick++;
+
+  /* Expired timeouts come off the list one at a time, because
+     each may cancel others. */
+  while (!list_empty (&expired))
+    {
+      struct timeout *t = list_entry (list_pop_front (&expired),
+                                      struct timeout, elem);
+      t->pending = false;
+      w->fired_cnt++;
+      t->func (t->aux);
+    }
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -26,4 +28,29 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* A timeout: a function to call from the timer interrupt after a
+   number of ticks. */
+typedef void timeout_func (void *aux);
+
+struct timeout
+  {
+    struct list_elem elem;      /* Element in a timer wheel slot. */
+    int64_t expires;            /* Tick at which to run FUNC. */
+    timeout_func *func;         /* Function to run. */
+    void *aux;                  /* Argument to FUNC. */
+    bool pending;               /* Armed and not yet run? */
+  };
+
+void timeout_init (struct timeout *, timeout_func *, void *aux);
+void timeout_arm (struct timeout *, int64_t ticks);
+bool timeout_cancel (struct timeout *);
+
+/* Timer wheels driven by the caller, for testing. */
+struct timer_wheel;
+struct timer_wheel *timer_wheel_create (int64_t tick);
+void timer_wheel_destroy (struct timer_wheel *);
+void timer_wheel_arm (struct timer_wheel *, struct timeout *, int64_t ticks);
+int64_t timer_wheel_now (const struct timer_wheel *);
+void timer_wheel_advance (struct timer_wheel *, int64_t ticks);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,524 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Timer ticks between write-behind passes of the flusher thread. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Most sectors waiting for the read-ahead thread at once. Read-ahead is
+   only a hint, so requests past this are dropped. */
+#define READ_AHEAD_QUEUE 32
+
+/* A sector held in the cache. */
+struct cache_block
+  {
+    block_sector_t sector;      /* Sector held. */
+    bool valid;                 /* Does the block hold a sector? */
+    bool dirty;                 /* Modified since read or last written? */
+    bool accessed;              /* Used since the clock hand passed? */
+    bool loading;               /* Busy with a transfer or a fill? */
+    bool prefetched;            /* Read ahead and not yet used? */
+    bool logged;                /* Changed by the running transaction? */
+    int pin_cnt;                /* >0: being copied in or out of. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes of data. */
+  };
+
+static struct cache_block cache[CACHE_SIZE];
+
+/* Next block the clock hand looks at. */
+static size_t clock_hand;
+
+/* Protects the cache. Not held across disk transfers in and out of it,
+   so that one thread's miss does not hold up another's hit: the block
+   is marked loading instead until the transfer is done, and anyone after
+   its sector waits on ra_loaded meanwhile. A write of a whole sector
+   that was not cached marks its block loading the same way until the new
+   data is copied in, since the block holds another sector's bytes until
+   then.
+
+   Nor is it held while copying to or from the caller's buffer. The block
+   is pinned instead, so that it cannot be evicted meanwhile. Callers
+   pass kernel buffers only, so the copy cannot fail and leave the pin
+   behind: system calls go through a kernel page of their own.
+
+   The journal's lock may be taken while this one is held, never the
+   other way around. */
+static struct lock cache_lock;
+
+/* Sectors waiting to be read ahead, a circular queue. */
+static block_sector_t ra_queue[READ_AHEAD_QUEUE];
+static size_t ra_head;          /* Index of the oldest request. */
+static size_t ra_cnt;           /* Number of requests queued. */
+static struct condition ra_queued;  /* Signaled when a request arrives. */
+static struct condition ra_loaded;  /* Broadcast when a block is done
+                                       loading. */
+
+/* Upped by flush_timeout every FLUSH_INTERVAL ticks. */
+static struct timeout flush_timeout;
+static struct semaphore flush_due;
+
+/* Cache statistics. */
+static struct
+  {
+    long long hits;             /* # of accesses found in the cache. */
+    long long misses;           /* # of accesses that had to read in. */
+    long long write_backs;      /* # of dirty sectors written back. */
+    long long read_aheads;      /* # of sectors read ahead. */
+    long long read_ahead_hits;  /* # of those used before eviction. */
+    long long direct_reads;     /* # of sectors read around the cache. */
+  }
+stats;
+
+static struct cache_block *lookup (block_sector_t);
+static struct cache_block *get_block (block_sector_t, bool read);
+static bool do_write (block_sector_t, const void *, int ofs, int size,
+                      bool meta);
+static struct cache_block *evict (void);
+static void write_back (struct cache_block *);
+static timeout_func flush_tick;
+static thread_func flusher NO_RETURN;
+static thread_func read_ahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache and starts the threads that write dirty
+   sectors back and read sectors ahead in the background. */
+void
+cache_init (void)
+{
+  uint8_t *pages;
+  size_t i;
+
+  pages = palloc_get_multiple (PAL_ASSERT,
+                               CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].valid = false;
+      cache[i].data = pages + i * BLOCK_SECTOR_SIZE;
+    }
+  lock_init (&cache_lock);
+  cond_init (&ra_queued);
+  cond_init (&ra_loaded);
+  sema_init (&flush_due, 0);
+  timeout_init (&flush_timeout, flush_tick, NULL);
+  timeout_arm (&flush_timeout, FLUSH_INTERVAL);
+
+  thread_create ("cache-flush", PRI_DEFAULT, flusher, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Reads SIZE bytes at offset OFS within SECTOR into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+  ASSERT (is_kernel_vaddr (buffer));
+
+  lock_acquire (&cache_lock);
+  b = get_block (sector, true);
+  b->pin_cnt++;
+  lock_release (&cache_lock);
+
+  memcpy (buffer, b->data + ofs, size);
+
+  lock_acquire (&cache_lock);
+  b->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Reads all of SECTOR into BUFFER. If the sector is cached, it is copied
+   from the cache. Otherwise it is read from disk straight into BUFFER,
+   and is not brought into the cache: this is for callers that keep the
+   data themselves, such as page faults loading a frame. */
+void
+cache_read_direct (block_sector_t sector, void *buffer)
+{
+  struct cache_block *b;
+
+  lock_acquire (&cache_lock);
+  while ((b = lookup (sector)) != NULL && b->loading)
+    cond_wait (&ra_loaded, &cache_lock);
+  if (b == NULL)
+    {
+      stats.direct_reads++;
+      lock_release (&cache_lock);
+      block_read (fs_device, sector, buffer);
+      return;
+    }
+  stats.hits++;
+  b->accessed = true;
+  b->pin_cnt++;
+  lock_release (&cache_lock);
+
+  memcpy (buffer, b->data, BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  b->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR. The sector
+   reaches the disk later, when it is evicted or flushed. Only a partial
+   write has to read the sector in first. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  do_write (sector, buffer, ofs, size, false);
+}
+
+/* Like cache_write(), but for file system metadata, which is added to
+   the journal's running transaction. The sector does not reach its home
+   on disk until the transaction is committed to the log.
+   Returns true if successful, false if the transaction has no room for
+   SECTOR, in which case SECTOR is left unchanged. */
+bool
+cache_write_meta (block_sector_t sector, const void *buffer, int ofs,
+                  int size)
+{
+  return do_write (sector, buffer, ofs, size, true);
+}
+
+/* Asks for SECTOR to be brought into the cache in the background, unless
+   it is already there or too many requests are pending. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (ra_cnt < READ_AHEAD_QUEUE && lookup (sector) == NULL)
+    {
+      ra_queue[(ra_head + ra_cnt++) % READ_AHEAD_QUEUE] = sector;
+      cond_signal (&ra_queued, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector in the cache back to disk, except those that
+   belong to the journal's running transaction. Also waits for write-backs
+   already under way, so that everything committed is on disk when this
+   returns. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_block *b = &cache[i];
+
+      while (b->loading)
+        cond_wait (&ra_loaded, &cache_lock);
+      if (b->valid && b->dirty && !b->logged)
+        write_back (b);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Tells the cache that the journal's running transaction has been
+   committed, so that the sectors it changed may be written back. */
+void
+cache_commit (void)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    cache[i].logged = false;
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld write-backs\n",
+          stats.hits, stats.misses, stats.write_backs);
+  printf ("Cache: %lld sectors read ahead, %lld used\n",
+          stats.read_aheads, stats.read_ahead_hits);
+  printf ("Cache: %lld sectors read directly\n", stats.direct_reads);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR, adding the
+   sector to the journal's running transaction if META is true.
+   Returns true if successful, false if the transaction has no room for
+   it. */
+static bool
+do_write (block_sector_t sector, const void *buffer, int ofs, int size,
+          bool meta)
+{
+  struct cache_block *b;
+  bool fill;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+  ASSERT (is_kernel_vaddr (buffer));
+
+  /* Join the transaction before changing the data, so that the
+     flusher cannot write the change back in the meantime. */
+  lock_acquire (&cache_lock);
+  b = get_block (sector, size < BLOCK_SECTOR_SIZE);
+  fill = b->loading;
+  if (meta && !b->logged && !journal_add (sector, &b->logged))
+    {
+      /* A block taken for the sector without reading it in holds
+         none of its data yet. */
+      if (fill)
+        {
+          b->valid = false;
+          b->loading = false;
+          cond_broadcast (&ra_loaded, &cache_lock);
+        }
+      lock_release (&cache_lock);
+      return false;
+    }
+  b->pin_cnt++;
+  lock_release (&cache_lock);
+
+  memcpy (b->data + ofs, buffer, size);
+
+  lock_acquire (&cache_lock);
+  b->dirty = true;
+  b->pin_cnt--;
+  if (fill)
+    {
+      b->loading = false;
+      cond_broadcast (&ra_loaded, &cache_lock);
+    }
+  lock_release (&cache_lock);
+  return true;
+}
+
+/* Returns the block holding SECTOR, or a null pointer if it is not
+   cached. The cache lock must be held. */
+static struct cache_block *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns the block holding SECTOR, bringing it into the cache if it is
+   not there. If READ is false the caller is about to overwrite the whole
+   sector, so its old contents are not read in; if they are not in the
+   cache either, the block is returned loading, and the caller must clear
+   that and broadcast ra_loaded once the data is in. Waits for a block of
+   the sector that is loading to be done. The cache lock must be held,
+   but is released while reading the sector in. */
+static struct cache_block *
+get_block (block_sector_t sector, bool read)
+{
+  struct cache_block *b;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      while ((b = lookup (sector)) != NULL && b->loading)
+        cond_wait (&ra_loaded, &cache_lock);
+      if (b != NULL)
+        break;
+
+      /* Someone else may have brought the sector in while evict()
+         had the lock released. Then the victim is left free. */
+      b = evict ();
+      if (lookup (sector) == NULL)
+        break;
+    }
+
+  if (b->valid)
+    {
+      stats.hits++;
+      if (b->prefetched)
+        {
+          b->prefetched = false;
+          stats.read_ahead_hits++;
+        }
+    }
+  else
+    {
+      stats.misses++;
+      b->sector = sector;
+      b->valid = true;
+      b->dirty = false;
+      b->loading = false;
+      b->prefetched = false;
+      b->pin_cnt = 0;
+
+      /* A sector of the running transaction that was evicted is not
+         on disk yet: the journal has it. */
+      b->logged = journal_unshadow (sector, b->data);
+      if (b->logged)
+        b->dirty = true;
+      else
+        {
+          b->loading = true;
+          if (read)
+            {
+              lock_release (&cache_lock);
+              block_read (fs_device, sector, b->data);
+              lock_acquire (&cache_lock);
+              b->loading = false;
+              cond_broadcast (&ra_loaded, &cache_lock);
+            }
+        }
+    }
+
+  b->accessed = true;
+  return b;
+}
+
+/* Chooses a block to reuse with the clock algorithm, writing it back
+   first if it is dirty, and returns it invalid. Pinned and loading
+   blocks are passed over; if nothing else is left, gives their owners a
+   chance to finish. A block of the journal's running transaction is
+   handed to the journal instead of being written back, since it may not
+   go home before the transaction commits, and passed over too if the
+   journal has no memory to keep it in. The cache lock must be held,
+   but may be released meanwhile. */
+static struct cache_block *
+evict (void)
+{
+  size_t passed = 0;
+
+  for (;;)
+    {
+      struct cache_block *b = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!b->valid)
+        return b;
+      if (b->pin_cnt == 0 && !b->loading)
+        {
+          if (b->accessed)
+            {
+              b->accessed = false;
+              continue;
+            }
+          if (!b->logged || journal_shadow (b->sector, b->data))
+            {
+              if (b->logged)
+                b->dirty = false;
+              if (b->dirty)
+                write_back (b);
+              b->valid = false;
+              b->logged = false;
+              return b;
+            }
+        }
+
+      if (++passed >= 2 * CACHE_SIZE)
+        {
+          lock_release (&cache_lock);
+          thread_yield ();
+          lock_acquire (&cache_lock);
+          passed = 0;
+        }
+    }
+}
+
+/* Writes block B back to disk. The cache lock must be held, but is
+   released during the write, with B marked loading so that nobody
+   changes or reuses it meanwhile. */
+static void
+write_back (struct cache_block *b)
+{
+  ASSERT (b->valid && b->dirty && !b->loading);
+
+  b->dirty = false;
+  b->loading = true;
+  lock_release (&cache_lock);
+
+  block_write (fs_device, b->sector, b->data);
+
+  lock_acquire (&cache_lock);
+  b->loading = false;
+  stats.write_backs++;
+  cond_broadcast (&ra_loaded, &cache_lock);
+}
+
+/* Tells the flusher a pass is due and rearms itself, so that passes
+   start on a fixed period however long each one takes. Runs in the
+   timer interrupt handler. */
+static void
+flush_tick (void *aux UNUSED)
+{
+  sema_up (&flush_due);
+  timeout_arm (&flush_timeout, FLUSH_INTERVAL);
+}
+
+/* Writes dirty sectors back every FLUSH_INTERVAL ticks, so that little is
+   lost if the machine goes down without filesys_done() being called. */
+static void
+flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&flush_due);
+
+      /* One pass makes up for any that came due during the last. */
+      while (sema_try_down (&flush_due))
+        continue;
+      cache_flush ();
+    }
+}
+
+/* Reads queued sectors into the cache, one at a time, so that disk
+   latency overlaps with whatever the reader does in the meantime. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      struct cache_block *b;
+      block_sector_t sector;
+
+      while (ra_cnt == 0)
+        cond_wait (&ra_queued, &cache_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+      ra_cnt--;
+      if (lookup (sector) != NULL)
+        continue;
+
+      b = evict ();
+      if (lookup (sector) != NULL)
+        continue;
+      b->sector = sector;
+      b->valid = true;
+      if (journal_unshadow (sector, b->data))
+        {
+          /* Nothing to read: the journal had it. */
+          b->dirty = b->logged = true;
+          b->accessed = true;
+          b->loading = b->prefetched = false;
+          b->pin_cnt = 0;
+          continue;
+        }
+      b->dirty = false;
+      b->accessed = true;
+      b->loading = true;
+      b->prefetched = true;
+      b->pin_cnt = 1;
+      lock_release (&cache_lock);
+
+      block_read (fs_device, sector, b->data);
+
+      lock_acquire (&cache_lock);
+      b->loading = false;
+      b->pin_cnt--;
+      stats.read_aheads++;
+      cond_broadcast (&ra_loaded, &cache_lock);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Number of sectors the buffer cache holds. */
+#define CACHE_SIZE 64
+
+void cache_init (void);
+void cache_read (block_sector_t, void *buffer, int ofs, int size);
+void cache_read_direct (block_sector_t, void *buffer);
+void cache_write (block_sector_t, const void *buffer, int ofs, int size);
+bool cache_write_meta (block_sector_t, const void *buffer, int ofs,
+                       int size);
+void cache_read_ahead (block_sector_t);
+void cache_flush (void);
+void cache_commit (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,183 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* A cached directory entry: NAME in the directory whose inode is
+   in sector DIR is the file whose inode is in sector SECTOR, or
+   does not exist if SECTOR is DCACHE_ABSENT. */
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t sector;              /* File's inode sector. */
+  };
+
+static struct dcache_entry entries[DCACHE_SIZE];
+
+/* Cached entries, keyed by directory and name. */
+static struct hash dcache;
+
+/* Every entry, in use or not, most recently used first. Entries
+   not in use are at the back, so they are reused first. */
+static struct list lru_list;
+
+/* Protects the cache. Callers also hold the directory's lock, for
+   reading to look up an entry or cache what they just read from
+   the directory, and for writing to record an entry they add or
+   remove, so that the cache never goes back to an older state of
+   the directory. */
+static struct lock dcache_lock;
+
+/* Cache statistics. */
+static long long hit_cnt;               /* # of lookups found. */
+static long long miss_cnt;              /* # of lookups not found. */
+
+static hash_hash_func dcache_hash;
+static hash_less_func dcache_less;
+static struct dcache_entry *find (block_sector_t dir, const char *name);
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  hash_init (&dcache, dcache_hash, dcache_less, NULL);
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      entries[i].name[0] = '\0';
+      list_push_back (&lru_list, &entries[i].lru_elem);
+    }
+}
+
+/* Looks up NAME in directory DIR. If it is cached, stores the
+   sector of its inode, or DCACHE_ABSENT, into *SECTORP and returns
+   true. Otherwise returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  e = find (dir, name);
+  if (e != NULL)
+    {
+      list_remove (&e->lru_elem);
+      list_push_front (&lru_list, &e->lru_elem);
+      *sectorp = e->sector;
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return e != NULL;
+}
+
+/* Records that NAME in directory DIR has its inode in SECTOR, or
+   does not exist if SECTOR is DCACHE_ABSENT, reusing the least
+   recently used entry. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               block_sector_t sector)
+{
+  struct dcache_entry *e;
+
+  ASSERT (strlen (name) <= NAME_MAX);
+
+  lock_acquire (&dcache_lock);
+  e = find (dir, name);
+  if (e == NULL)
+    {
+      e = list_entry (list_back (&lru_list), struct dcache_entry,
+                      lru_elem);
+      if (e->name[0] != '\0')
+        hash_delete (&dcache, &e->hash_elem);
+      e->dir = dir;
+      strlcpy (e->name, name, sizeof e->name);
+      hash_insert (&dcache, &e->hash_elem);
+    }
+  e->sector = sector;
+  list_remove (&e->lru_elem);
+  list_push_front (&lru_list, &e->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every entry for names in directory DIR, which has been
+   removed, so that a directory later created in the same sector
+   does not inherit them. */
+void
+dcache_purge_dir (block_sector_t dir)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      struct dcache_entry *e = &entries[i];
+      if (e->name[0] != '\0' && e->dir == dir)
+        {
+          hash_delete (&dcache, &e->hash_elem);
+          e->name[0] = '\0';
+          list_remove (&e->lru_elem);
+          list_push_back (&lru_list, &e->lru_elem);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dcache: %lld hits, %lld misses\n", hit_cnt, miss_cnt);
+}
+
+/* Returns the cached entry for NAME in directory DIR, or a null
+   pointer if there is none. The cache lock must be held. */
+static struct dcache_entry *
+find (block_sector_t dir, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Returns a hash value for the entry in E. */
+static unsigned
+dcache_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct dcache_entry *e = hash_entry (e_, struct dcache_entry,
+                                             hash_elem);
+  return hash_string (e->name) ^ hash_int (e->dir);
+}
+
+/* Returns true if the entry in A orders before the one in B. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                             hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                             hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
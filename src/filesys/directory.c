@@ -1,10 +1,15 @@
 #include "filesys/directory.h"
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
-#include <list.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -21,12 +26,51 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A directory's file is an array of buckets, one per sector. A
+   name hashes to one of the first BUCKET_CNT buckets, its home
+   bucket. When the home bucket fills up, further entries go into
+   overflow buckets chained from it, which are allocated past the
+   home buckets. Buckets that have never been written, whether in
+   a hole or past end of file, read back as empty. */
+#define BUCKET_CNT 64
+
+/* Number of entries in a bucket. */
+#define BUCKET_ENTRIES \
+  ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) / sizeof (struct dir_entry))
+
+/* A bucket of directory entries.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRIES]; /* Entries. */
+    uint32_t next;                      /* Overflow bucket, 0 if none. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - sizeof (uint32_t)
+                   - BUCKET_ENTRIES * sizeof (struct dir_entry)];
+  };
+
+/* Creates an empty directory in the given SECTOR, inside the
+   directory whose inode is in sector PARENT. Buckets are
+   allocated as entries are added to them. "." and ".." are not
+   stored as entries: they are answered from the inode itself.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct inode *inode;
+  bool success;
+
+  /* If this assertion fails, the bucket structure is not exactly
+     one sector in size, and you should fix that. */
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  if (!inode_create (sector, 0, true))
+    return false;
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  success = inode_set_parent (inode, parent);
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,51 +127,111 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the home bucket of NAME. */
+static uint32_t
+home_bucket (const char *name)
+{
+  return hash_string (name) % BUCKET_CNT;
+}
+
+/* Reads bucket IDX of DIR into B. */
+static void
+read_bucket (const struct dir *dir, uint32_t idx, struct dir_bucket *b)
+{
+  off_t read = inode_read_at (dir->inode, b, sizeof *b,
+                              (off_t) idx * BLOCK_SECTOR_SIZE);
+  memset ((uint8_t *) b + read, 0, sizeof *b - read);
+}
+
+/* Returns the byte offset of entry I of bucket IDX. */
+static off_t
+entry_ofs (uint32_t idx, size_t i)
+{
+  return (off_t) idx * BLOCK_SECTOR_SIZE + i * sizeof (struct dir_entry);
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   Only NAME's home bucket and its overflow chain are read. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_bucket b;
+  uint32_t idx;
+  size_t i;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  idx = home_bucket (name);
+  do
+    {
+      read_bucket (dir, idx, &b);
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (b.entries[i].in_use && !strcmp (name, b.entries[i].name)) 
+          {
+            if (ep != NULL)
+              *ep = b.entries[i];
+            if (ofsp != NULL)
+              *ofsp = entry_ofs (idx, i);
+            return true;
+          }
+      idx = b.next;
+    }
+  while (idx != 0);
   return false;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Names that are not found are cached too, so that looking them
+   up again does not read the directory. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector, sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  if (!strcmp (name, "."))
+    {
+      *inode = inode_reopen (dir->inode);
+      return true;
+    }
+  if (!strcmp (name, ".."))
+    {
+      *inode = inode_open (inode_get_parent (dir->inode));
+      return *inode != NULL;
+    }
+
+  dir_sector = inode_get_inumber (dir->inode);
+  rwlock_acquire_read (inode_dir_lock (dir->inode));
+  if (dcache_lookup (dir_sector, name, &sector))
+    *inode = sector != DCACHE_ABSENT ? inode_open (sector) : NULL;
+  else if (lookup (dir, name, &e, NULL))
+    {
+      dcache_insert (dir_sector, name, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
   else
-    *inode = NULL;
+    {
+      if (strlen (name) <= NAME_MAX)
+        dcache_insert (dir_sector, name, DCACHE_ABSENT);
+      *inode = NULL;
+    }
+  rwlock_release_read (inode_dir_lock (dir->inode));
 
   return *inode != NULL;
 }
@@ -136,51 +240,92 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long, "." or "..") or a disk
+   or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_bucket b;
   struct dir_entry e;
-  off_t ofs;
+  uint32_t idx;
+  off_t ofs = -1;
+  size_t i;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  rwlock_acquire_write (inode_dir_lock (dir->inode));
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Check that NAME is not in use, and set OFS to the offset of
+     the first free slot in its chain, if there is one. */
+  idx = home_bucket (name);
+  for (;;)
+    {
+      read_bucket (dir, idx, &b);
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (!b.entries[i].in_use)
+          {
+            if (ofs < 0)
+              ofs = entry_ofs (idx, i);
+          }
+        else if (!strcmp (name, b.entries[i].name))
+          goto done;
+      if (b.next == 0)
+        break;
+      idx = b.next;
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (ofs >= 0)
+    success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  else
+    {
+      /* The chain is full: put the entry in a new overflow bucket
+         at end of file and link it to the last bucket of the
+         chain. */
+      uint32_t new_idx = DIV_ROUND_UP (inode_length (dir->inode),
+                                       BLOCK_SECTOR_SIZE);
+      if (new_idx < BUCKET_CNT)
+        new_idx = BUCKET_CNT;
+      success = (inode_write_at (dir->inode, &e, sizeof e,
+                                 entry_ofs (new_idx, 0)) == sizeof e
+                 && inode_write_at (dir->inode, &new_idx, sizeof new_idx,
+                                    entry_ofs (idx, 0)
+                                    + offsetof (struct dir_bucket, next))
+                    == sizeof new_idx);
+    }
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
+  rwlock_release_write (inode_dir_lock (dir->inode));
   return success;
 }
 
+/* Returns true if directory INODE has no entries. */
+static bool
+is_empty (struct inode *inode)
+{
+  struct dir dir = { inode, 0 };
+  char name[NAME_MAX + 1];
+
+  return !dir_readdir (&dir, name);
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs if there is no file with the given NAME, or if it
+   is a directory that is not empty or that is open elsewhere
+   (for example, as some process's working directory). */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
@@ -192,6 +337,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  rwlock_acquire_write (inode_dir_lock (dir->inode));
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -201,16 +348,27 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only an empty directory that nobody else has open may go.
+     Nobody can open it while we check, because that means looking
+     it up in DIR, which we hold locked. */
+  if (inode_is_dir (inode)
+      && (inode_open_cnt (inode) > 1 || !is_empty (inode)))
+    goto done;
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_ABSENT);
+  if (inode_is_dir (inode))
+    dcache_purge_dir (e.inode_sector);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  rwlock_release_write (inode_dir_lock (dir->inode));
   inode_close (inode);
   return success;
 }
@@ -222,15 +380,29 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  rwlock_acquire_read (inode_dir_lock (dir->inode));
+  while (dir->pos < inode_length (dir->inode))
     {
+      /* Skip the tail of the bucket that holds no entries. */
+      if (dir->pos % BLOCK_SECTOR_SIZE
+          >= (off_t) (BUCKET_ENTRIES * sizeof e))
+        {
+          dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
+          continue;
+        }
+
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  rwlock_release_read (inode_dir_lock (dir->inode));
+  return success;
 }
@@ -2,6 +2,11 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* Bounds on the read-ahead window, in sectors. */
+#define FILE_RA_SECTORS_MIN 2
+#define FILE_RA_SECTORS_MAX 16
 
 /* An open file. */
 struct file 
@@ -9,8 +14,13 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of what has been read ahead. */
+    int ra_window;              /* Read-ahead window, 0 if not sequential. */
   };
 
+static void read_ahead (struct file *, off_t file_ofs, off_t bytes_read);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +33,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -69,6 +81,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +94,62 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Reads SIZE bytes from FILE into PAGE, a buffer of PGSIZE bytes,
+   starting at offset FILE_OFS, which must be sector-aligned, and
+   with SIZE at most PGSIZE. Sectors not in the buffer cache are read
+   straight into PAGE. Bytes of PAGE past those read are left
+   undefined.
+   Returns the number of bytes actually read,
+   which may be less than SIZE if end of file is reached.
+   The file's current position is unaffected. */
+off_t
+file_read_page (struct file *file, void *page, off_t size, off_t file_ofs) 
+{
+  ASSERT (size <= PGSIZE);
+  return inode_read_page (file->inode, page, size, file_ofs);
+}
+
+/* Notes that BYTES_READ bytes were just read from FILE at FILE_OFS. If
+   the read carried on where the last one stopped, the window doubles up
+   to FILE_RA_SECTORS_MAX sectors and the part of it not yet asked for is
+   queued for the read-ahead thread; any other read closes the window. */
+static void
+read_ahead (struct file *file, off_t file_ofs, off_t bytes_read)
+{
+  off_t start, end;
+
+  if (file_ofs != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  else if (file->ra_window == 0)
+    file->ra_window = FILE_RA_SECTORS_MIN;
+  else if (file->ra_window < FILE_RA_SECTORS_MAX)
+    file->ra_window *= 2;
+  file->ra_next = file_ofs + bytes_read;
+
+  if (file->ra_window == 0)
+    return;
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  end = file->ra_next + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (end > start)
+    {
+      inode_read_ahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +162,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
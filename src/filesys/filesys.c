@@ -2,10 +2,14 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,12 +25,15 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
+  journal_init (format);
   free_map_open ();
 }
 
@@ -36,8 +43,109 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_done ();
 }
 
+/* Opens the directory that contains the last component of PATH
+   and copies that component into NAME. A path that starts with
+   "/" is absolute; any other is relative to the current thread's
+   working directory. A path that names the root directory itself
+   yields the root and ".".
+   Returns the directory, which the caller must close, or a null
+   pointer if PATH is empty, has a component longer than NAME_MAX,
+   or goes through something that is not a directory. */
+static struct dir *
+resolve (const char *path, char name[NAME_MAX + 1])
+{
+  struct thread *cur = thread_current ();
+  struct dir *dir;
+  size_t len;
+
+  if (*path == '\0')
+    return NULL;
+  if (*path == '/' || cur->cwd == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (cur->cwd);
+
+  strlcpy (name, ".", NAME_MAX + 1);
+  for (;;)
+    {
+      while (*path == '/')
+        path++;
+      if (*path == '\0' || dir == NULL)
+        return dir;
+
+      len = strcspn (path, "/");
+      if (len > NAME_MAX)
+        break;
+
+      /* NAME is not the last component after all: step into it. */
+      if (strcmp (name, "."))
+        {
+          struct inode *inode;
+
+          if (!dir_lookup (dir, name, &inode))
+            break;
+          dir_close (dir);
+          if (!inode_is_dir (inode))
+            {
+              inode_close (inode);
+              return NULL;
+            }
+          dir = dir_open (inode);
+        }
+
+      memcpy (name, path, len);
+      name[len] = '\0';
+      path += len;
+    }
+  dir_close (dir);
+  return NULL;
+}
+
+/* Creates a file, or a directory if IS_DIR is true, at PATH, as a
+   single journal operation, so that a crash cannot leave the
+   inode's sectors allocated without a directory entry for it.
+   Returns true if successful, false otherwise. */
+static bool
+create (const char *path, off_t initial_size, bool is_dir)
+{
+  block_sector_t inode_sector = 0;
+  char name[NAME_MAX + 1];
+  struct dir *dir = resolve (path, name);
+  block_sector_t parent;
+  bool success = false;
+
+  if (dir == NULL)
+    return false;
+  parent = inode_get_inumber (dir_get_inode (dir));
+  journal_begin ();
+  if (free_map_allocate (1, parent, &inode_sector))
+    {
+      if (is_dir
+          ? dir_create (inode_sector, parent)
+          : inode_create (inode_sector, initial_size, false))
+        {
+          success = dir_add (dir, name, inode_sector);
+          if (!success)
+            {
+              /* Removing the inode frees its sector too. */
+              struct inode *inode = inode_open (inode_sector);
+              if (inode != NULL)
+                inode_remove (inode);
+              inode_close (inode);
+            }
+        }
+      else
+        free_map_release (inode_sector, 1);
+    }
+  journal_end ();
+  dir_close (dir);
+
+  return success;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -45,20 +153,20 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
+  return create (name, initial_size, false);
+}
 
-  return success;
+/* Creates an empty directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  return create (name, 0, true);
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,37 +174,70 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve (name, base);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, base, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve (name, base);
+  bool success;
+
+  journal_begin ();
+  success = dir != NULL && dir_remove (dir, base);
+  journal_end ();
   dir_close (dir); 
 
   return success;
 }
-
+
+/* Changes the current thread's working directory to NAME.
+   Returns true if successful, false on failure. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *cur = thread_current ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = resolve (name, base);
+  struct inode *inode = NULL;
+
+  if (dir != NULL)
+    dir_lookup (dir, base, &inode);
+  dir_close (dir);
+
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (cur->cwd);
+  cur->cwd = dir;
+  return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -1,70 +1,270 @@
 #include "filesys/free-map.h"
-#include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
+/* A run of free sectors. */
+struct extent
+  {
+    block_sector_t start;       /* First free sector. */
+    block_sector_t length;      /* Number of free sectors. */
+  };
+
+/* Most free extents the free map file holds as a list. A device
+   of N sectors could need N / 2 + 1 of them at worst, far more
+   than real use ever fragments it into. */
+#define EXTENT_MAX 1024
+
+/* Count that marks the free map file as holding a bitmap. */
+#define BITMAP_FORM UINT32_MAX
+
+/* Sectors covered by one chunk of the bitmap. */
+#define CHUNK_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/* The free map is the list of free extents, sorted by starting
+   sector, with adjacent extents always merged. The array grows
+   as needed. If memory runs out, an allocation is taken from the
+   start of a free extent rather than split it.
+
+   On disk, the free map file holds the number of extents
+   followed by the extents themselves. A disk fragmented into
+   more than EXTENT_MAX extents is written as BITMAP_FORM followed
+   by a bitmap instead, with a set bit for each sector in use.
+   The file is sized for the bigger of the two when the file
+   system is formatted, so that writing it never has to grow it.
+
+   The file is written once per journal commit, and only if the
+   map changed, rather than on every allocation. */
 static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct extent *extents;       /* Free extents, by start. */
+static size_t extent_cnt;            /* Number of free extents. */
+static size_t extent_room;           /* Room in EXTENTS. */
+static bool free_map_dirty;          /* Changed since last written? */
+static uint8_t chunk[CHUNK_BITS / 8]; /* Staging for the bitmap. */
+
+/* Extents released by operations that are not committed yet. They
+   stay allocated until the journal commits the transaction that
+   released them, so that a crash cannot leave them in use by a
+   new owner and by the old one as well. */
+static struct extent *pending;       /* Released extents. */
+static size_t pending_cnt;           /* Number of released extents. */
+static size_t pending_max;           /* Room in PENDING. */
+
+static struct lock free_map_lock;    /* Protects all of the above. */
+
+static bool make_room (size_t cnt);
+static size_t find_extent (block_sector_t);
+static void take (size_t idx, block_sector_t, size_t cnt);
+static void give_back (block_sector_t, size_t cnt);
+static off_t map_file_size (void);
+static bool write_free_map (void);
+static bool read_bitmap (void);
+static bool write_bitmap (void);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
-    PANIC ("bitmap creation failed--file system device is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  if (!make_room (4))
+    PANIC ("free map creation failed");
+  extents[0].start = 0;
+  extents[0].length = block_size (fs_device);
+  extent_cnt = 1;
+  free_map_dirty = false;
+  lock_init (&free_map_lock);
+
+  take (find_extent (FREE_MAP_SECTOR), FREE_MAP_SECTOR, 1);
+  take (find_extent (ROOT_DIR_SECTOR), ROOT_DIR_SECTOR, 1);
+  take (find_extent (JOURNAL_SECTOR), JOURNAL_SECTOR, journal_size ());
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP. The first free run at or after GOAL
+   is taken, falling back to the start of the disk. The free map
+   file is brought up to date by the next journal commit; see
+   free_map_flush().
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (size_t cnt, block_sector_t goal, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t first, i;
+  bool split_ok;
+  bool success = false;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  split_ok = make_room (extent_cnt + 1);
+  first = find_extent (goal);
+  for (i = 0; i < extent_cnt; i++)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      size_t idx = (first + i) % extent_cnt;
+      struct extent *e = &extents[idx];
+      block_sector_t start = e->start;
+
+      /* Within the extent holding GOAL, start at GOAL if the
+         run fits past it and there is room to split the extent. */
+      if (i == 0 && goal > start && goal - start + cnt <= e->length
+          && split_ok)
+        start = goal;
+      if (e->start + e->length - start >= cnt)
+        {
+          take (idx, start, cnt);
+          free_map_dirty = true;
+          *sectorp = start;
+          success = true;
+          break;
+        }
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use once
+   the journal commits the caller's operation; see
+   free_map_commit(). On disk, they stay allocated until the free
+   map is next written after that, so a crash in between leaks
+   them but never hands them out twice. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  struct extent *last;
+
+  if (cnt == 0)
+    return;
+
+  lock_acquire (&free_map_lock);
+  last = pending_cnt > 0 ? &pending[pending_cnt - 1] : NULL;
+  if (last != NULL && last->start + last->length == sector)
+    last->length += cnt;
+  else
+    {
+      if (pending_cnt >= pending_max)
+        {
+          size_t max = pending_max > 0 ? pending_max * 2 : 16;
+          struct extent *p = realloc (pending, max * sizeof *pending);
+          if (p == NULL)
+            PANIC ("can't record released sectors");
+          pending = p;
+          pending_max = max;
+        }
+      pending[pending_cnt].start = sector;
+      pending[pending_cnt].length = cnt;
+      pending_cnt++;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Returns true if the free map has changes for the journal to
+   commit: sectors allocated since the free map file was last
+   written, or released since the last call to free_map_commit(). */
+bool
+free_map_pending (void)
+{
+  bool pending_any;
+
+  lock_acquire (&free_map_lock);
+  pending_any = free_map_dirty || pending_cnt > 0;
+  lock_release (&free_map_lock);
+  return pending_any;
+}
+
+/* Makes the sectors released since the last call available for
+   use. Called by the journal, with no operation in progress,
+   once the transaction that released them is committed.
+   Returns true if the log holds an old copy of any of them, in
+   which case the journal must empty the log before they are
+   handed out, or replaying it after a crash would write over
+   whatever their new owner put there. */
+bool
+free_map_commit (void)
+{
+  bool logged = false;
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < pending_cnt; i++)
+    {
+      if (journal_in_log (pending[i].start, pending[i].length))
+        logged = true;
+      give_back (pending[i].start, pending[i].length);
+    }
+  if (pending_cnt > 0)
+    free_map_dirty = true;
+  pending_cnt = 0;
+  lock_release (&free_map_lock);
+  return logged;
+}
+
+/* Writes the free map to its file if it changed since it was
+   last written. Called by the journal as part of each commit,
+   once no operation is in progress, so that the sectors the
+   transaction allocated are recorded in use by the transaction
+   itself. */
+void
+free_map_flush (void)
+{
+  lock_acquire (&free_map_lock);
+  if (free_map_dirty && free_map_file != NULL && !write_free_map ())
+    PANIC ("can't write free map");
+  lock_release (&free_map_lock);
+}
+
+/* Returns the number of sectors of the free map file, which the
+   journal sets aside room for in every transaction. */
+size_t
+free_map_size (void)
+{
+  return DIV_ROUND_UP (map_file_size (), BLOCK_SECTOR_SIZE);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void) 
 {
+  uint32_t cnt;
+
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  if (file_read_at (free_map_file, &cnt, sizeof cnt, 0) != sizeof cnt)
+    PANIC ("can't read free map");
+  if (cnt == BITMAP_FORM)
+    {
+      if (!read_bitmap ())
+        PANIC ("can't read free map");
+    }
+  else if (cnt > EXTENT_MAX
+           || !make_room (cnt)
+           || (file_read_at (free_map_file, extents,
+                             cnt * sizeof *extents, sizeof cnt)
+               != (off_t) (cnt * sizeof *extents)))
     PANIC ("can't read free map");
+  else
+    extent_cnt = cnt;
+  free_map_dirty = false;
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  /* The first commit gets back whatever is still pending, and
+     the second writes what it got back. Before the journal is
+     running, the free map is written straight away instead. */
+  journal_commit ();
+  journal_commit ();
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,14 +272,250 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  static uint8_t zeros[BLOCK_SECTOR_SIZE];
+  off_t size = map_file_size ();
+  off_t ofs;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, size, false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Fill in every sector of the file, so that writing the free
+     map never allocates any. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  for (ofs = 0; ofs < size; ofs += BLOCK_SECTOR_SIZE)
+    if (file_write_at (free_map_file, zeros, BLOCK_SECTOR_SIZE, ofs)
+        != BLOCK_SECTOR_SIZE)
+      PANIC ("free map creation failed");
+
+  /* Write extents to file. */
+  lock_acquire (&free_map_lock);
+  if (!write_free_map ())
     PANIC ("can't write free map");
+  lock_release (&free_map_lock);
+}
+
+/* Makes sure EXTENTS has room for CNT extents, growing it if
+   necessary. Returns false if memory runs out. The free map lock
+   must be held once the file system is running. */
+static bool
+make_room (size_t cnt)
+{
+  size_t room;
+  struct extent *e;
+
+  if (cnt <= extent_room)
+    return true;
+
+  room = extent_room > 0 ? extent_room : 16;
+  while (room < cnt)
+    room *= 2;
+  e = realloc (extents, room * sizeof *extents);
+  if (e == NULL)
+    return false;
+  extents = e;
+  extent_room = room;
+  return true;
+}
+
+/* Returns the index of the first extent that ends after SECTOR,
+   or EXTENT_CNT if there is none. The free map lock must be held
+   once the file system is running. */
+static size_t
+find_extent (block_sector_t sector) 
+{
+  size_t lo = 0, hi = extent_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (extents[mid].start + extents[mid].length <= sector)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Removes the CNT sectors starting at SECTOR, which must all lie
+   within extent IDX, from the free map. */
+static void
+take (size_t idx, block_sector_t sector, size_t cnt) 
+{
+  struct extent *e = &extents[idx];
+  block_sector_t end = e->start + e->length;
+
+  ASSERT (idx < extent_cnt);
+  ASSERT (e->start <= sector && sector + cnt <= end);
+
+  if (sector == e->start)
+    {
+      e->start += cnt;
+      e->length -= cnt;
+      if (e->length == 0)
+        {
+          memmove (e, e + 1, (extent_cnt - idx - 1) * sizeof *extents);
+          extent_cnt--;
+        }
+    }
+  else if (sector + cnt == end)
+    e->length -= cnt;
+  else
+    {
+      /* Split the extent in two. */
+      if (!make_room (extent_cnt + 1))
+        PANIC ("free map is full");
+      e = &extents[idx];
+      memmove (e + 1, e, (extent_cnt - idx) * sizeof *extents);
+      extent_cnt++;
+      e->length = sector - e->start;
+      e[1].start = sector + cnt;
+      e[1].length = end - (sector + cnt);
+    }
+}
+
+/* Adds the CNT sectors starting at SECTOR to the free map, merging
+   them with the extents on either side. */
+static void
+give_back (block_sector_t sector, size_t cnt) 
+{
+  size_t idx;
+  struct extent *prev, *next;
+
+  /* Find the first extent past SECTOR. */
+  idx = find_extent (sector);
+  if (idx < extent_cnt && extents[idx].start <= sector)
+    idx++;
+  prev = idx > 0 ? &extents[idx - 1] : NULL;
+  next = idx < extent_cnt ? &extents[idx] : NULL;
+  ASSERT (prev == NULL || prev->start + prev->length <= sector);
+  ASSERT (next == NULL || sector + cnt <= next->start);
+
+  if (prev != NULL && prev->start + prev->length == sector)
+    {
+      prev->length += cnt;
+      if (next != NULL && sector + cnt == next->start)
+        {
+          prev->length += next->length;
+          memmove (next, next + 1,
+                   (extent_cnt - idx - 1) * sizeof *extents);
+          extent_cnt--;
+        }
+    }
+  else if (next != NULL && sector + cnt == next->start)
+    {
+      next->start = sector;
+      next->length += cnt;
+    }
+  else
+    {
+      if (!make_room (extent_cnt + 1))
+        PANIC ("free map is full");
+      memmove (&extents[idx + 1], &extents[idx],
+               (extent_cnt - idx) * sizeof *extents);
+      extents[idx].start = sector;
+      extents[idx].length = cnt;
+      extent_cnt++;
+    }
+}
+
+/* Returns the size of the free map file: room for the count and
+   for the list of extents or the bitmap, whichever is bigger. */
+static off_t
+map_file_size (void)
+{
+  size_t list_size = EXTENT_MAX * sizeof *extents;
+  size_t bitmap_size = DIV_ROUND_UP (block_size (fs_device), 8);
+
+  return sizeof (uint32_t) + (list_size > bitmap_size
+                              ? list_size : bitmap_size);
+}
+
+/* Writes the free map to the free map file, as a list of the
+   extents in use or, if there are more than EXTENT_MAX of them,
+   as a bitmap. Returns true if successful, false otherwise. The
+   free map lock must be held, and the caller must be in a
+   journal operation or commit once the journal is running, so
+   that the count and the map change together. */
+static bool
+write_free_map (void) 
+{
+  uint32_t cnt = extent_cnt <= EXTENT_MAX ? extent_cnt : BITMAP_FORM;
+  off_t size = extent_cnt * sizeof *extents;
+
+  if (file_write_at (free_map_file, &cnt, sizeof cnt, 0) != sizeof cnt)
+    return false;
+  if (cnt == BITMAP_FORM
+      ? !write_bitmap ()
+      : file_write_at (free_map_file, extents, size, sizeof cnt) != size)
+    return false;
+  free_map_dirty = false;
+  return true;
+}
+
+/* Reads the bitmap form of the free map file into EXTENTS.
+   Returns true if successful, false otherwise. */
+static bool
+read_bitmap (void)
+{
+  block_sector_t sectors = block_size (fs_device);
+  block_sector_t base, sector;
+
+  extent_cnt = 0;
+  for (base = 0; base < sectors; base += CHUNK_BITS)
+    {
+      block_sector_t end = sectors - base < CHUNK_BITS
+                           ? sectors : base + CHUNK_BITS;
+      off_t size = DIV_ROUND_UP (end - base, 8);
+
+      if (file_read_at (free_map_file, chunk, size,
+                        sizeof (uint32_t) + base / 8) != size)
+        return false;
+      for (sector = base; sector < end; sector++)
+        if (!(chunk[(sector - base) / 8] & (1u << (sector - base) % 8)))
+          give_back (sector, 1);
+    }
+  return true;
+}
+
+/* Writes EXTENTS to the free map file in the bitmap form, one
+   chunk at a time. Returns true if successful, false otherwise.
+   The free map lock must be held. */
+static bool
+write_bitmap (void)
+{
+  block_sector_t sectors = block_size (fs_device);
+  block_sector_t base, sector;
+  size_t idx = 0;
+
+  for (base = 0; base < sectors; base += CHUNK_BITS)
+    {
+      block_sector_t end = sectors - base < CHUNK_BITS
+                           ? sectors : base + CHUNK_BITS;
+      off_t size = DIV_ROUND_UP (end - base, 8);
+
+      /* Mark everything in use, then clear the bits of the free
+         extents that overlap the chunk. An extent that runs on
+         past the chunk is looked at again for the next one. */
+      memset (chunk, 0xff, sizeof chunk);
+      while (idx < extent_cnt && extents[idx].start < end)
+        {
+          struct extent *e = &extents[idx];
+          block_sector_t e_end = e->start + e->length;
+
+          for (sector = e->start > base ? e->start : base;
+               sector < e_end && sector < end; sector++)
+            chunk[(sector - base) / 8] &= ~(1u << (sector - base) % 8);
+          if (e_end > end)
+            break;
+          idx++;
+        }
+
+      if (file_write_at (free_map_file, chunk, size,
+                         sizeof (uint32_t) + base / 8) != size)
+        return false;
+    }
+  return true;
 }
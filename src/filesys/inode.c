@@ -1,79 +1,308 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
-#include <round.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Sector numbers held by one index sector. */
+#define INDEX_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Layout of an inode's block pointers: DIRECT_CNT data sectors, then one
+   indirect sector, then one doubly indirect sector. */
+#define DIRECT_CNT 122
+#define INDIRECT DIRECT_CNT
+#define DOUBLY_INDIRECT (DIRECT_CNT + 1)
+
+/* Largest number of data sectors an inode can have, and the
+   corresponding file size in bytes. */
+#define MAX_SECTORS (DIRECT_CNT + INDEX_CNT + INDEX_CNT * INDEX_CNT)
+#define MAX_LENGTH ((off_t) (MAX_SECTORS * BLOCK_SECTOR_SIZE))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A block pointer of 0 is a hole that reads as zeros: sector 0 holds the
+   free map's inode, so it is never a data or index sector. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    block_sector_t blocks[DIRECT_CNT + 2]; /* Direct and index sectors. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
+    block_sector_t parent;              /* Parent of a directory. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
-
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* DATA not read in yet? */
+    struct condition loaded;            /* Broadcast when DATA is in. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    block_sector_t goal;                /* Where to look for a free sector. */
     struct inode_disk data;             /* Inode content. */
+
+    /* Held for reading while looking up data sectors, for writing
+       while adding them, growing the file, or changing
+       deny_write_cnt. Never held while copying file data, which
+       may fault in user pages. */
+    struct rwlock rw;
+    struct rwlock dir_rw;               /* See inode_dir_lock(). */
   };
 
+static bool allocate_sector (struct inode *, block_sector_t *, bool meta);
+
+/* Returns true if INODE holds file system metadata: the free map,
+   or a directory. Its data goes through the journal. */
+static bool
+is_meta (const struct inode *inode)
+{
+  return inode->sector == FREE_MAP_SECTOR || inode->data.is_dir;
+}
+
+/* Returns block pointer I of INODE, first filling the hole there
+   with a new sector if ALLOCATE is true. Returns 0 for a hole. */
+static block_sector_t
+inode_entry (struct inode *inode, size_t i, bool allocate)
+{
+  block_sector_t *entry = &inode->data.blocks[i];
+
+  if (*entry == 0 && allocate
+      && allocate_sector (inode, entry, i >= DIRECT_CNT || is_meta (inode))
+      && !cache_write_meta (inode->sector, entry,
+                            (uint8_t *) entry - (uint8_t *) &inode->data,
+                            sizeof *entry))
+    {
+      free_map_release (*entry, 1);
+      *entry = 0;
+    }
+  return *entry;
+}
+
+/* Returns entry I of index sector TABLE, first filling the hole
+   there with a new sector for INODE if ALLOCATE is true. Returns 0
+   for a hole. IS_TABLE tells whether the entry refers to another
+   index sector rather than to data. */
+static block_sector_t
+index_entry (struct inode *inode, block_sector_t table, size_t i,
+             bool allocate, bool is_table)
+{
+  block_sector_t entry;
+
+  if (table == 0)
+    return 0;
+  cache_read (table, &entry, i * sizeof entry, sizeof entry);
+  if (entry == 0 && allocate
+      && allocate_sector (inode, &entry, is_table || is_meta (inode))
+      && !cache_write_meta (table, &entry, i * sizeof entry, sizeof entry))
+    {
+      free_map_release (entry, 1);
+      entry = 0;
+    }
+  return entry;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns 0 if INODE has no data sector for POS, because it lies in a
+   hole or past the largest possible file. If ALLOCATE is true, holes
+   on the way are filled with new zeroed sectors, so that 0 is then
+   returned only if the disk is full or the journal's running
+   transaction has no room for the change. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool allocate) 
 {
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t table;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  ASSERT (pos >= 0);
+
+  if (idx < DIRECT_CNT)
+    return inode_entry (inode, idx, allocate);
+  idx -= DIRECT_CNT;
+
+  if (idx < INDEX_CNT)
+    {
+      table = inode_entry (inode, INDIRECT, allocate);
+      return index_entry (inode, table, idx, allocate, false);
+    }
+  idx -= INDEX_CNT;
+
+  if (idx < INDEX_CNT * INDEX_CNT)
+    {
+      table = inode_entry (inode, DOUBLY_INDIRECT, allocate);
+      table = index_entry (inode, table, idx / INDEX_CNT, allocate, true);
+      return index_entry (inode, table, idx % INDEX_CNT, allocate, false);
+    }
+  return 0;
+}
+
+/* Allocates a zeroed sector for INODE and stores it into *SECTORP.
+   The search starts just past the sector INODE got last, so that a
+   file written sequentially stays contiguous on disk. The zeros
+   are journaled if META is true. File data is not, so a crash can
+   leave stale data in a sector just given to a file, but never a
+   stale index.
+   Returns true if successful, false if the disk is full or the
+   zeros do not fit in the journal's running transaction. */
+static bool
+allocate_sector (struct inode *inode, block_sector_t *sectorp, bool meta) 
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate (1, inode->goal, sectorp))
+    return false;
+  if (!meta)
+    cache_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  else if (!cache_write_meta (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE))
+    {
+      free_map_release (*sectorp, 1);
+      return false;
+    }
+  inode->goal = *sectorp + 1;
+  return true;
+}
+
+/* Consecutive sectors waiting to be handed back to the free map
+   together, since the sectors of a file are mostly contiguous. */
+struct release_run
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* Adds SECTOR to RUN, first releasing RUN if SECTOR does not
+   extend it. */
+static void
+release_sector (struct release_run *run, block_sector_t sector) 
+{
+  if (run->cnt > 0 && sector == run->start + run->cnt)
+    run->cnt++;
   else
-    return -1;
+    {
+      free_map_release (run->start, run->cnt);
+      run->start = sector;
+      run->cnt = 1;
+    }
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Releases SECTOR and, if it is an index sector LEVEL levels above
+   the data, every sector it refers to. An index sector is
+   allocated just before the first sector it points to, so it goes
+   first to keep the run going. */
+static void
+release_sectors (struct release_run *run, block_sector_t sector, int level) 
+{
+  size_t i;
+
+  if (sector == 0)
+    return;
+  release_sector (run, sector);
+  if (level > 0)
+    for (i = 0; i < INDEX_CNT; i++)
+      {
+        block_sector_t entry;
+
+        cache_read (sector, &entry, i * sizeof entry, sizeof entry);
+        release_sectors (run, entry, level - 1);
+      }
+}
+
+/* Releases every data and index sector of INODE, in as few calls
+   to the free map as its layout allows, and the inode's own sector
+   as well if it has been removed. */
+static void
+deallocate (struct inode *inode) 
+{
+  struct release_run run = {0, 0};
+  size_t i;
+
+  if (inode->removed)
+    release_sector (&run, inode->sector);
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_sectors (&run, inode->data.blocks[i], 0);
+  release_sectors (&run, inode->data.blocks[INDIRECT], 1);
+  release_sectors (&run, inode->data.blocks[DOUBLY_INDIRECT], 2);
+  free_map_release (run.start, run.cnt);
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt and loading of each open
+   inode. Not held while an inode is read from disk: the inode goes
+   into the table marked loading instead, and anyone else opening
+   it waits on its loaded condition meanwhile. */
+static struct lock open_inodes_lock;
+
+/* Inode table statistics. */
+static long long open_calls;             /* # of calls to inode_open(). */
+static size_t open_peak;                /* Most inodes open at once. */
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+}
+
+/* Prints open inode table statistics. */
+void
+inode_print_stats (void) 
+{
+  printf ("Inodes: %lld opens, %zu open at most\n", open_calls, open_peak);
+}
+
+/* Returns a hash value for the inode in E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if the inode in A has a lower sector than the one
+   in B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device, as a directory if IS_DIR is true. The data is left as
+   one big hole, which reads back as zeros, so that creating a
+   file is a small journal operation however long it is; sectors
+   are allocated as they are first written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails, LENGTH is too big,
+   or the journal's running transaction has no room for the
+   inode. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  bool success;
 
   ASSERT (length >= 0);
 
@@ -81,27 +310,17 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (length > MAX_LENGTH)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  success = cache_write_meta (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+  free (disk_inode);
   return success;
 }
 
@@ -111,33 +330,57 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+  open_calls++;
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, and enter the inode in the table before reading
+     it from disk, so that a concurrent opener of the same sector
+     waits for it rather than reading it a second time. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
+  cond_init (&inode->loaded);
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->goal = sector + 1;
+  rwlock_init (&inode->rw);
+  rwlock_init (&inode->dir_rw);
+  hash_insert (&open_inodes, &inode->elem);
+  if (hash_size (&open_inodes) > open_peak)
+    open_peak = hash_size (&open_inodes);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,10 +389,61 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns the sector of the inode of the directory that contains
+   directory INODE. The root directory is its own parent. */
+block_sector_t
+inode_get_parent (const struct inode *inode)
+{
+  ASSERT (inode_is_dir (inode));
+  return inode->data.parent;
+}
+
+/* Records PARENT as the directory that contains directory INODE.
+   Returns true if successful, false if the journal's running
+   transaction has no room for the change. */
+bool
+inode_set_parent (struct inode *inode, block_sector_t parent)
+{
+  bool success;
+
+  ASSERT (inode_is_dir (inode));
+  rwlock_acquire_write (&inode->rw);
+  success = cache_write_meta (inode->sector, &parent,
+                              offsetof (struct inode_disk, parent),
+                              sizeof parent);
+  if (success)
+    inode->data.parent = parent;
+  rwlock_release_write (&inode->rw);
+  return success;
+}
+
+/* Returns the number of openers of INODE. */
+int
+inode_open_cnt (struct inode *inode)
+{
+  int open_cnt;
+
+  lock_acquire (&open_inodes_lock);
+  open_cnt = inode->open_cnt;
+  lock_release (&open_inodes_lock);
+  return open_cnt;
+}
+
 /* Returns INODE's inode number. */
 block_sector_t
 inode_get_inumber (const struct inode *inode)
@@ -163,22 +457,27 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_begin ();
+          deallocate (inode);
+          journal_end ();
         }
 
       free (inode); 
@@ -202,12 +501,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,59 +518,121 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy the chunk out of the buffer cache, or zeros for a hole. */
+      rwlock_acquire_read (&inode->rw);
+      sector_idx = byte_to_sector (inode, offset, false);
+      rwlock_release_read (&inode->rw);
+      if (sector_idx != 0)
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Reads SIZE bytes from INODE into PAGE, starting at position OFFSET,
+   which must be a multiple of BLOCK_SECTOR_SIZE. PAGE must have room
+   for SIZE bytes rounded up to a whole sector, and whatever follows
+   the bytes read in the last sector is left undefined.
+   Unlike inode_read_at(), sectors that are not in the buffer cache are
+   read from disk straight into PAGE, so that loading a page does not
+   copy it twice or push other sectors out of the cache.
+   Returns the number of bytes actually read, which may be less than
+   SIZE if end of file is reached. */
+off_t
+inode_read_page (struct inode *inode, void *page_, off_t size,
+                 off_t offset)
+{
+  uint8_t *page = page_;
+  off_t length = inode_length (inode) - offset;
+  off_t ofs;
+
+  ASSERT (offset % BLOCK_SECTOR_SIZE == 0);
+
+  /* Metadata may be newer in the journal than on disk. */
+  if (is_meta (inode))
+    return inode_read_at (inode, page, size, offset);
+
+  if (size > length)
+    size = length;
+  for (ofs = 0; ofs < size; ofs += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector_idx;
+
+      rwlock_acquire_read (&inode->rw);
+      sector_idx = byte_to_sector (inode, offset + ofs, false);
+      rwlock_release_read (&inode->rw);
+      if (sector_idx != 0)
+        cache_read_direct (sector_idx, page + ofs);
+      else
+        memset (page + ofs, 0, BLOCK_SECTOR_SIZE);
+    }
+  return size > 0 ? size : 0;
+}
+
+/* Asks for the sectors holding SIZE bytes of INODE, starting at position
+   OFFSET, to be read into the buffer cache in the background. Bytes past
+   end of file and holes are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t pos;
+
+  rwlock_acquire_read (&inode->rw);
+  for (pos = offset - offset % BLOCK_SECTOR_SIZE;
+       pos < offset + size && pos < inode_length (inode);
+       pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos, false);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+  rwlock_release_read (&inode->rw);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up, the file reaches its
+   largest possible size, or the journal's running transaction
+   has no room for a change to the file's metadata.
+   A write past end of file extends the inode. Sectors it skips
+   over are left as holes that read back as zeros.
+   Each sector allocated, and the change of length, is a journal
+   operation of its own, unless the caller has one going. A write
+   to a directory or the free map is a single operation, since
+   those are never written from user memory. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool meta = is_meta (inode);
+  bool denied;
 
-  if (inode->deny_write_cnt)
+  rwlock_acquire_read (&inode->rw);
+  denied = inode->deny_write_cnt > 0;
+  rwlock_release_read (&inode->rw);
+  if (denied)
     return 0;
 
+  if (meta)
+    journal_begin ();
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in largest inode, bytes left in sector, lesser of
+         the two. */
+      off_t inode_left = MAX_LENGTH - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,38 +641,65 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Find the sector, allocating it if it is a hole. Writers
+         that overwrite existing data need only read the index. */
+      rwlock_acquire_read (&inode->rw);
+      sector_idx = byte_to_sector (inode, offset, false);
+      rwlock_release_read (&inode->rw);
+      if (sector_idx == 0)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          journal_begin ();
+          rwlock_acquire_write (&inode->rw);
+          sector_idx = byte_to_sector (inode, offset, true);
+          rwlock_release_write (&inode->rw);
+          journal_end ();
+          if (sector_idx == 0)
+            break;
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+      /* Copy the chunk into the buffer cache.  It reads the sector in
+         first if the chunk does not cover all of it. */
+      if (meta)
+        {
+          if (!cache_write_meta (sector_idx, buffer + bytes_written,
+                                 sector_ofs, chunk_size))
+            break;
         }
+      else
+        cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                     chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file if we wrote past its end. */
+  if (offset > inode_length (inode))
+    {
+      journal_begin ();
+      rwlock_acquire_write (&inode->rw);
+      if (offset > inode->data.length)
+        {
+          if (cache_write_meta (inode->sector, &offset,
+                                offsetof (struct inode_disk, length),
+                                sizeof offset))
+            inode->data.length = offset;
+          else
+            {
+              /* Only what was written before the old end of file
+                 counts. */
+              off_t start = offset - bytes_written;
+              bytes_written = (inode->data.length > start
+                               ? inode->data.length - start : 0);
+            }
+        }
+      rwlock_release_write (&inode->rw);
+      journal_end ();
+    }
+  if (meta)
+    journal_end ();
 
   return bytes_written;
 }
@@ -322,8 +709,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +721,22 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
+}
+
+/* Returns the lock that serializes changes to the entries of
+   directory INODE. Lookups hold it for reading, dir_add() and
+   dir_remove() for writing. It is separate from the lock on the
+   inode's data, which the directory code takes in turn through
+   inode_read_at() and inode_write_at(). */
+struct rwlock *
+inode_dir_lock (struct inode *inode)
+{
+  return &inode->dir_rw;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
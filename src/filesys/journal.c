@@ -0,0 +1,547 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Identify the blocks of the journal. */
+#define HEADER_MAGIC 0x4a524e4c
+#define DESC_MAGIC 0x44455343
+#define COMMIT_MAGIC 0x434d4954
+
+/* Timer ticks between commits of the running transaction. */
+#define COMMIT_INTERVAL TIMER_FREQ
+
+/* Sectors an operation is assumed to change at most. A new
+   operation waits for a commit unless the running transaction
+   has room for this many more for it and for every operation in
+   progress, so that the transaction never outgrows the log. */
+#define OP_RESERVE 16
+
+/* Home sectors named by one descriptor block. */
+#define DESC_CNT ((BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)) \
+                  / sizeof (block_sector_t))
+
+/* The journal is a header sector, JOURNAL_SECTOR, followed by the
+   log. A transaction is logged as a descriptor block naming up to
+   DESC_CNT home sectors, followed by their contents, repeated as
+   often as needed, and then a commit block. Every block of a
+   transaction carries its sequence number, and the header holds
+   the sequence number of the first transaction in the log, so
+   that whatever is left over from older transactions stops
+   replay.
+
+   Only metadata goes through the log: inodes, index sectors,
+   directories and the free map, which is written once per
+   transaction, at commit, in room set aside for it. File data is
+   written straight home, so after a crash a file may hold stale
+   data in sectors it had just been given, but the file system is
+   always consistent.
+
+   Sectors that a transaction frees are not reused before it
+   commits, and not while the log holds an old copy of any of
+   them either: the log is emptied first, since replay would
+   write the copy over whatever the new owner put there.
+
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_block
+  {
+    uint32_t magic;                     /* One of the *_MAGIC values. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Descriptor: # of sectors. */
+    block_sector_t sectors[DESC_CNT];   /* Descriptor: home sectors. */
+  };
+
+/* Contents of a sector changed by the running transaction, kept
+   when the buffer cache evicts it, since it may not go home
+   before the transaction commits. */
+struct shadow
+  {
+    struct list_elem elem;              /* Element in shadows. */
+    block_sector_t sector;              /* Home sector. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Contents. */
+  };
+
+/* The log. */
+static block_sector_t log_start;        /* First sector. */
+static size_t log_size;                 /* Number of sectors. */
+static size_t log_pos;                  /* Next sector to write. */
+static block_sector_t *log_homes;       /* Home sectors in the log. */
+static size_t log_home_cnt;             /* Number of LOG_HOMES. */
+static uint32_t next_seq;               /* Running transaction's number. */
+
+/* The running transaction. All operations that start between two
+   commits belong to it. */
+static block_sector_t *txn;             /* Home sectors changed. */
+static size_t txn_cnt;                  /* Number of sectors in TXN. */
+static size_t txn_max;                  /* Most that the log takes. */
+static size_t map_reserve;              /* Of TXN_MAX, kept for free map. */
+static struct list shadows;             /* Evicted TXN sectors. */
+static int active_cnt;                  /* Operations in progress. */
+static bool closing;                    /* Being committed? */
+
+/* Protects all of the above. Never held while calling into the
+   buffer cache, which calls back in with its own lock held. */
+static struct lock journal_lock;
+static struct condition ops_done;       /* Broadcast at active_cnt 0. */
+static struct condition txn_open;       /* Broadcast after a commit. */
+
+/* Upped by commit_timeout every COMMIT_INTERVAL ticks. */
+static struct timeout commit_timeout;
+static struct semaphore commit_due;
+
+/* True once the journal is started, false before and after. */
+static bool running;
+
+/* Staging buffers for commits and replay, which only ever run one
+   at a time. */
+static struct journal_block block;
+static uint8_t image[BLOCK_SECTOR_SIZE];
+
+/* Journal statistics. */
+static struct
+  {
+    long long ops;              /* # of operations. */
+    long long commits;          /* # of transactions committed. */
+    long long logged;           /* # of sectors logged. */
+    long long replayed;         /* # of transactions replayed. */
+  }
+stats;
+
+static size_t log_space (size_t cnt);
+static void replay (void);
+static void reset_log (void);
+static void write_log (void);
+static void write_shadows (void);
+static timeout_func commit_tick;
+static thread_func committer NO_RETURN;
+
+/* Returns the number of sectors, starting at JOURNAL_SECTOR, that
+   the journal takes up on the file system device. */
+size_t
+journal_size (void)
+{
+  return 1 + block_size (fs_device) / 64 + 64;
+}
+
+/* Initializes the journal and starts the thread that commits
+   transactions. Unless FORMAT is true, first replays the
+   transactions committed to the log before the last shutdown or
+   crash, so this must run before anything reads the disk. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof block == BLOCK_SECTOR_SIZE);
+
+  log_start = JOURNAL_SECTOR + 1;
+  log_size = journal_size () - 1;
+  txn_max = log_size / 2;
+  while (log_space (txn_max) > log_size / 2)
+    txn_max--;
+  map_reserve = free_map_size ();
+  if (txn_max < map_reserve + OP_RESERVE)
+    PANIC ("journal is too small");
+  txn = malloc (txn_max * sizeof *txn);
+  log_homes = malloc (log_size * sizeof *log_homes);
+  if (txn == NULL || log_homes == NULL)
+    PANIC ("can't allocate journal");
+  list_init (&shadows);
+  lock_init (&journal_lock);
+  cond_init (&ops_done);
+  cond_init (&txn_open);
+
+  if (format)
+    next_seq = 1;
+  else
+    {
+      block_read (fs_device, JOURNAL_SECTOR, &block);
+      if (block.magic != HEADER_MAGIC)
+        PANIC ("journal header is corrupt");
+      next_seq = block.seq;
+      replay ();
+    }
+  reset_log ();
+  running = true;
+
+  sema_init (&commit_due, 0);
+  timeout_init (&commit_timeout, commit_tick, NULL);
+  timeout_arm (&commit_timeout, COMMIT_INTERVAL);
+  thread_create ("journal", PRI_DEFAULT, committer, NULL);
+}
+
+/* Commits the running transaction and writes everything home,
+   leaving the log empty. */
+void
+journal_done (void)
+{
+  journal_commit ();
+  running = false;
+  cache_flush ();
+  reset_log ();
+}
+
+/* Starts an operation: a group of metadata changes that reach the
+   disk together or not at all. Operations nest; only the
+   outermost counts. Must not be called with any file system lock
+   held, because it may wait for a commit, which waits for every
+   operation in progress to end. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth > 0 || !running)
+    {
+      t->journal_depth++;
+      return;
+    }
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      while (closing)
+        cond_wait (&txn_open, &journal_lock);
+      if (txn_cnt + (active_cnt + 1) * OP_RESERVE + map_reserve
+          <= txn_max)
+        break;
+      if (txn_cnt == 0)
+        {
+          /* Nothing to commit yet: the room is all set aside for
+             the operations in progress. */
+          cond_wait (&ops_done, &journal_lock);
+          continue;
+        }
+      lock_release (&journal_lock);
+      journal_commit ();
+      lock_acquire (&journal_lock);
+    }
+  active_cnt++;
+  stats.ops++;
+  lock_release (&journal_lock);
+  t->journal_depth++;
+}
+
+/* Ends the operation started by the matching journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0 || !running)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--active_cnt == 0)
+    cond_broadcast (&ops_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction. New operations are held off
+   while the ones in progress finish, then every sector the
+   transaction changed is written to the log in one sequential
+   run, followed by the commit block. From then on the sectors may
+   go home in any order. This way the operations of all the
+   threads that got in since the last commit cost a single log
+   write between them. */
+void
+journal_commit (void)
+{
+  struct thread *t = thread_current ();
+  bool freed;
+
+  ASSERT (t->journal_depth == 0);
+
+  if (!running)
+    return;
+
+  freed = free_map_pending ();
+  lock_acquire (&journal_lock);
+  while (closing)
+    cond_wait (&txn_open, &journal_lock);
+  if (txn_cnt == 0 && !freed)
+    {
+      lock_release (&journal_lock);
+      return;
+    }
+  closing = true;
+  while (active_cnt > 0)
+    cond_wait (&ops_done, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* Record what the transaction allocated. Writing the free map
+     counts as part of the commit rather than an operation of its
+     own, which would wait for the commit to finish. */
+  t->journal_depth++;
+  free_map_flush ();
+  t->journal_depth--;
+
+  if (txn_cnt > 0)
+    write_log ();
+  cache_commit ();
+  write_shadows ();
+
+  /* Start the log over if the next transaction might not fit, or
+     if it holds an old copy of a sector that was just freed and
+     may now be reused, which replay would write over. Nothing is
+     left uncommitted in the cache at this point, so once it is
+     all home the log is no longer needed. */
+  if (free_map_commit () || log_pos + log_space (txn_max) > log_size)
+    {
+      cache_flush ();
+      reset_log ();
+    }
+
+  lock_acquire (&journal_lock);
+  txn_cnt = 0;
+  closing = false;
+  cond_broadcast (&txn_open, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Adds SECTOR, which an operation is about to change in the
+   buffer cache, to the running transaction, and sets *LOGGED to
+   true, in which case the cache must not write SECTOR home until
+   the transaction commits. If the journal is not running, sets
+   *LOGGED to false instead, and SECTOR is written back as usual.
+
+   Returns false, without adding SECTOR, if the transaction is
+   full. The room set aside by journal_begin() keeps the
+   transaction within the log, so that only happens to an
+   operation that changes far more than OP_RESERVE sectors. It
+   must then fail without changing SECTOR, since writing it home
+   early would give up its atomicity. Only the commit itself,
+   which writes the free map, may use the room kept for that. */
+bool
+journal_add (block_sector_t sector, bool *logged)
+{
+  bool success;
+
+  *logged = false;
+  if (!running)
+    return true;
+
+  lock_acquire (&journal_lock);
+  success = txn_cnt < (closing ? txn_max : txn_max - map_reserve);
+  if (success)
+    {
+      txn[txn_cnt++] = sector;
+      stats.logged++;
+      *logged = true;
+    }
+  lock_release (&journal_lock);
+  return success;
+}
+
+/* Keeps a copy of DATA, the contents of SECTOR, which was added to
+   the running transaction and is being evicted from the buffer
+   cache. Returns true if successful, false if out of memory. */
+bool
+journal_shadow (block_sector_t sector, const void *data)
+{
+  struct shadow *s = malloc (sizeof *s);
+  if (s == NULL)
+    return false;
+  s->sector = sector;
+  memcpy (s->data, data, BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&journal_lock);
+  list_push_back (&shadows, &s->elem);
+  lock_release (&journal_lock);
+  return true;
+}
+
+/* If there is a copy of SECTOR kept by journal_shadow(), moves it
+   into DATA and returns true. Otherwise returns false. */
+bool
+journal_unshadow (block_sector_t sector, void *data)
+{
+  struct list_elem *e;
+  struct shadow *s = NULL;
+
+  lock_acquire (&journal_lock);
+  for (e = list_begin (&shadows); e != list_end (&shadows);
+       e = list_next (e))
+    if (list_entry (e, struct shadow, elem)->sector == sector)
+      {
+        s = list_entry (e, struct shadow, elem);
+        list_remove (e);
+        break;
+      }
+  lock_release (&journal_lock);
+
+  if (s == NULL)
+    return false;
+  memcpy (data, s->data, BLOCK_SECTOR_SIZE);
+  free (s);
+  return true;
+}
+
+/* Returns true if the log holds a copy of any of the CNT sectors
+   starting at SECTOR, which replay would write home. Only
+   meaningful while a commit is under way, since it is the only
+   thing that changes the log while the journal is running. */
+bool
+journal_in_log (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < log_home_cnt; i++)
+    if (log_homes[i] >= sector && log_homes[i] - sector < cnt)
+      return true;
+  return false;
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %lld operations, %lld commits, %lld sectors logged, "
+          "%lld transactions replayed\n",
+          stats.ops, stats.commits, stats.logged, stats.replayed);
+}
+
+/* Returns the number of log sectors a transaction that changes
+   CNT sectors takes up. */
+static size_t
+log_space (size_t cnt)
+{
+  return DIV_ROUND_UP (cnt, DESC_CNT) + cnt + 1;
+}
+
+/* Copies every committed transaction in the log home, oldest
+   first, stopping at the first one that was not committed. */
+static void
+replay (void)
+{
+  size_t pos = 0;
+
+  for (;;)
+    {
+      size_t end = pos, p, i;
+
+      /* Find the transaction's commit block. */
+      for (;;)
+        {
+          if (end >= log_size)
+            return;
+          block_read (fs_device, log_start + end, &block);
+          if (block.seq != next_seq)
+            return;
+          if (block.magic == COMMIT_MAGIC)
+            break;
+          if (block.magic != DESC_MAGIC || block.cnt > DESC_CNT)
+            return;
+          end += 1 + block.cnt;
+        }
+
+      /* Copy its sectors home. */
+      for (p = pos; p < end; p += 1 + block.cnt)
+        {
+          block_read (fs_device, log_start + p, &block);
+          for (i = 0; i < block.cnt; i++)
+            {
+              block_read (fs_device, log_start + p + 1 + i, image);
+              block_write (fs_device, block.sectors[i], image);
+            }
+        }
+      stats.replayed++;
+      next_seq++;
+      pos = end + 1;
+    }
+}
+
+/* Empties the log, by writing a header saying that it starts with
+   the running transaction. */
+static void
+reset_log (void)
+{
+  memset (&block, 0, sizeof block);
+  block.magic = HEADER_MAGIC;
+  block.seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, &block);
+  log_pos = 0;
+  log_home_cnt = 0;
+}
+
+/* Writes the running transaction to the log. */
+static void
+write_log (void)
+{
+  size_t i, j, cnt;
+
+  ASSERT (log_pos + log_space (txn_cnt) <= log_size);
+
+  for (i = 0; i < txn_cnt; i += cnt)
+    {
+      cnt = txn_cnt - i < DESC_CNT ? txn_cnt - i : DESC_CNT;
+      block.magic = DESC_MAGIC;
+      block.seq = next_seq;
+      block.cnt = cnt;
+      memcpy (block.sectors, txn + i, cnt * sizeof *txn);
+      memcpy (log_homes + log_home_cnt, txn + i, cnt * sizeof *txn);
+      log_home_cnt += cnt;
+      block_write (fs_device, log_start + log_pos++, &block);
+      for (j = 0; j < cnt; j++)
+        {
+          cache_read (txn[i + j], image, 0, BLOCK_SECTOR_SIZE);
+          block_write (fs_device, log_start + log_pos++, image);
+        }
+    }
+
+  memset (&block, 0, sizeof block);
+  block.magic = COMMIT_MAGIC;
+  block.seq = next_seq++;
+  block_write (fs_device, log_start + log_pos++, &block);
+  stats.commits++;
+}
+
+/* Writes home the committed sectors that were evicted from the
+   buffer cache before the commit. */
+static void
+write_shadows (void)
+{
+  lock_acquire (&journal_lock);
+  while (!list_empty (&shadows))
+    {
+      struct shadow *s = list_entry (list_pop_front (&shadows),
+                                     struct shadow, elem);
+      block_write (fs_device, s->sector, s->data);
+      free (s);
+    }
+  lock_release (&journal_lock);
+}
+
+/* Wakes the committer and rearms itself for the next interval.
+   Runs in the timer interrupt handler. */
+static void
+commit_tick (void *aux UNUSED)
+{
+  sema_up (&commit_due);
+  timeout_arm (&commit_timeout, COMMIT_INTERVAL);
+}
+
+/* Commits the running transaction every COMMIT_INTERVAL ticks, so
+   that little is lost in a crash even when operations are few. */
+static void
+committer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&commit_due);
+
+      /* Intervals missed while a commit was slow add up to one. */
+      while (sema_try_down (&commit_due))
+        continue;
+      journal_commit ();
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+size_t journal_size (void);
+void journal_init (bool format);
+void journal_done (void);
+
+/* Operations. */
+void journal_begin (void);
+void journal_end (void);
+void journal_commit (void);
+
+/* Used by the buffer cache. */
+bool journal_add (block_sector_t, bool *logged);
+bool journal_shadow (block_sector_t, const void *data);
+bool journal_unshadow (block_sector_t, void *data);
+
+/* Used by the free map. */
+bool journal_in_log (block_sector_t, size_t cnt);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,38 @@
+/* Child process for open-stress test.
+   Opens and closes every test file, starting at a different
+   file in each child so that the children contend for the open
+   inode table rather than follow each other through it. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/open-stress.h"
+
+const char *test_name = "child-open";
+
+int
+main (int argc, const char *argv[]) 
+{
+  int child_idx;
+  char name[16];
+  int i;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "f%d",
+                (i + child_idx * FILE_CNT / CHILD_CNT) % FILE_CNT);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      CHECK (filesize (fd) == 0, "filesize \"%s\"", name);
+      close (fd);
+    }
+
+  return child_idx;
+}
@@ -0,0 +1,34 @@
+/* Child process for syn-create test.
+   Creates FILE_CNT files whose names start with its child
+   number, removing every other one right after creating it. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-create.h"
+
+const char *test_name = "child-syn-crt";
+
+int
+main (int argc, const char *argv[]) 
+{
+  int child_idx;
+  char name[16];
+  int i;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "c%d-%d", child_idx, i);
+      CHECK (create (name, 512), "create \"%s\"", name);
+      if (i % 2 != 0)
+        CHECK (remove (name), "remove \"%s\"", name);
+    }
+
+  return child_idx;
+}
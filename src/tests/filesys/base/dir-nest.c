@@ -0,0 +1,43 @@
+/* Builds a small directory tree, works in it through relative
+   and absolute paths, and takes it down again.  A directory may
+   not be removed while it still holds a file, and a removed name
+   must stay gone. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char name[READDIR_MAX_LEN + 1];
+  int fd;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (mkdir ("a/b"), "mkdir \"a/b\"");
+  CHECK (!mkdir ("a/b"), "mkdir \"a/b\" again (must fail)");
+  CHECK (chdir ("a/b"), "chdir \"a/b\"");
+  CHECK (create ("f", 512), "create \"f\"");
+  CHECK ((fd = open ("/a/b/f")) > 1, "open \"/a/b/f\"");
+  CHECK (!isdir (fd), "isdir \"/a/b/f\" is false");
+  msg ("close \"/a/b/f\"");
+  close (fd);
+
+  CHECK (chdir (".."), "chdir \"..\"");
+  CHECK ((fd = open (".")) > 1, "open \".\"");
+  CHECK (isdir (fd), "isdir \".\" is true");
+  CHECK (readdir (fd, name) && !strcmp (name, "b"),
+         "readdir \".\" returns \"b\"");
+  CHECK (!readdir (fd, name), "readdir \".\" has no more entries");
+  msg ("close \".\"");
+  close (fd);
+
+  CHECK (!remove ("b"), "remove \"b\" (must fail)");
+  CHECK (remove ("b/f"), "remove \"b/f\"");
+  CHECK (open ("./b/f") == -1, "open \"./b/f\" (must return -1)");
+  CHECK (remove ("b"), "remove \"b\"");
+  CHECK (open ("b") == -1, "open \"b\" (must return -1)");
+  CHECK (chdir ("/"), "chdir \"/\"");
+  CHECK (remove ("a"), "remove \"a\"");
+}
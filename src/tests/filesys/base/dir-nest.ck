@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-nest) begin
+(dir-nest) mkdir "a"
+(dir-nest) mkdir "a/b"
+(dir-nest) mkdir "a/b" again (must fail)
+(dir-nest) chdir "a/b"
+(dir-nest) create "f"
+(dir-nest) open "/a/b/f"
+(dir-nest) isdir "/a/b/f" is false
+(dir-nest) close "/a/b/f"
+(dir-nest) chdir ".."
+(dir-nest) open "."
+(dir-nest) isdir "." is true
+(dir-nest) readdir "." returns "b"
+(dir-nest) readdir "." has no more entries
+(dir-nest) close "."
+(dir-nest) remove "b" (must fail)
+(dir-nest) remove "b/f"
+(dir-nest) open "./b/f" (must return -1)
+(dir-nest) remove "b"
+(dir-nest) open "b" (must return -1)
+(dir-nest) chdir "/"
+(dir-nest) remove "a"
+(dir-nest) end
+EOF
+pass;
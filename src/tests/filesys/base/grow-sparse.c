@@ -0,0 +1,38 @@
+/* Creates an empty file, then writes a block of data well past
+   its end, into the part of the file reached through the
+   indirect block.  The file must grow to cover the write, and
+   the skipped-over part must read back as zeros. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define GAP_SIZE 70000
+#define DATA_SIZE 1000
+
+static char buf[GAP_SIZE + DATA_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "sparse";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf + GAP_SIZE, DATA_SIZE);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\" to %d", file_name, GAP_SIZE);
+  seek (fd, GAP_SIZE);
+  CHECK (write (fd, buf + GAP_SIZE, DATA_SIZE) == DATA_SIZE,
+         "write %d bytes to \"%s\"", DATA_SIZE, file_name);
+  CHECK (filesize (fd) == GAP_SIZE + DATA_SIZE,
+         "filesize \"%s\" is %d", file_name, GAP_SIZE + DATA_SIZE);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse) begin
+(grow-sparse) create "sparse"
+(grow-sparse) open "sparse"
+(grow-sparse) seek "sparse" to 70000
+(grow-sparse) write 1000 bytes to "sparse"
+(grow-sparse) filesize "sparse" is 71000
+(grow-sparse) close "sparse"
+(grow-sparse) open "sparse" for verification
+(grow-sparse) verified contents of "sparse"
+(grow-sparse) close "sparse"
+(grow-sparse) end
+EOF
+pass;
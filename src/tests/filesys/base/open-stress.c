@@ -0,0 +1,54 @@
+/* Creates FILE_CNT files and keeps all of them open, so that the
+   kernel holds thousands of open inodes, then spawns CHILD_CNT
+   child processes that open and close every one of the files
+   again at the same time.  Finally closes and removes the files.
+
+   The kernel's "Inodes:" statistics line, together with its
+   "Timer:" line, gives the rate of opens. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/open-stress.h"
+
+static int fds[FILE_CNT];
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  char name[16];
+  int i;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+  msg ("created %d files", FILE_CNT);
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if ((fds[i] = open (name)) < 2)
+        fail ("open \"%s\"", name);
+    }
+  msg ("opened %d files", FILE_CNT);
+
+  exec_children ("child-open", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  for (i = 0; i < FILE_CNT; i++)
+    close (fds[i]);
+  msg ("closed %d files", FILE_CNT);
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+    }
+  msg ("removed %d files", FILE_CNT);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(open-stress) begin
+(open-stress) created 2000 files
+(open-stress) opened 2000 files
+(open-stress) exec child 1 of 4: "child-open 0"
+(open-stress) exec child 2 of 4: "child-open 1"
+(open-stress) exec child 3 of 4: "child-open 2"
+(open-stress) exec child 4 of 4: "child-open 3"
+(open-stress) wait for child 1 of 4 returned 0 (expected 0)
+(open-stress) wait for child 2 of 4 returned 1 (expected 1)
+(open-stress) wait for child 3 of 4 returned 2 (expected 2)
+(open-stress) wait for child 4 of 4 returned 3 (expected 3)
+(open-stress) closed 2000 files
+(open-stress) removed 2000 files
+(open-stress) end
+EOF
+pass;
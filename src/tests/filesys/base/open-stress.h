@@ -0,0 +1,7 @@
+#ifndef TESTS_FILESYS_BASE_OPEN_STRESS_H
+#define TESTS_FILESYS_BASE_OPEN_STRESS_H
+
+#define FILE_CNT 2000
+#define CHILD_CNT 4
+
+#endif /* tests/filesys/base/open-stress.h */
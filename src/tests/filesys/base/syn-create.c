@@ -0,0 +1,38 @@
+/* Spawns several child processes that each create and remove
+   many files at the same time, so that their directory and free
+   map updates are committed to the journal together.  Then
+   checks that exactly the files each child was to keep are
+   there. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/base/syn-create.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  char name[16];
+  int child, i;
+
+  exec_children ("child-syn-crt", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  for (child = 0; child < CHILD_CNT; child++)
+    for (i = 0; i < FILE_CNT; i++)
+      {
+        int fd;
+
+        snprintf (name, sizeof name, "c%d-%d", child, i);
+        fd = open (name);
+        if (i % 2 == 0 && fd < 2)
+          fail ("open \"%s\"", name);
+        if (i % 2 != 0 && fd != -1)
+          fail ("\"%s\" was not removed", name);
+        if (fd > 1)
+          close (fd);
+      }
+  msg ("verified %d files", CHILD_CNT * FILE_CNT / 2);
+}
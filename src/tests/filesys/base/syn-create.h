@@ -0,0 +1,7 @@
+#ifndef TESTS_FILESYS_BASE_SYN_CREATE_H
+#define TESTS_FILESYS_BASE_SYN_CREATE_H
+
+#define CHILD_CNT 4
+#define FILE_CNT 100
+
+#endif /* tests/filesys/base/syn-create.h */
@@ -0,0 +1,73 @@
+/* Creates N threads, each of which sleeps a short, fixed
+   duration M times, and counts the context switches taken
+   meanwhile.  A sleeping thread should cost the scheduler a
+   couple of switches per sleep, not a switch every time the CPU
+   passes it by, so the count must stay within a small multiple
+   of the number of sleeps plus the number of ticks elapsed. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 100
+#define ITERATIONS 10
+
+static thread_func sleeper;
+
+void
+test_alarm_bench (void) 
+{
+  struct semaphore done;
+  long long start_switches, switches, bound;
+  int64_t start_ticks, elapsed;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads to sleep %d times each.",
+       THREAD_CNT, ITERATIONS);
+  msg ("Thread N sleeps N %% 10 + 1 ticks each time.");
+
+  sema_init (&done, 0);
+  start_ticks = timer_ticks ();
+  start_switches = thread_switch_cnt ();
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "sleeper %d", i);
+      thread_create (name, PRI_DEFAULT, sleeper, &done);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  switches = thread_switch_cnt () - start_switches;
+  elapsed = timer_elapsed (start_ticks);
+
+  /* Each sleep switches away from the sleeper and back to it.
+     Starting and exiting cost a few more per thread.  Besides
+     that, allow for a switch into and out of the idle thread and
+     a preemption on every tick. */
+  bound = (long long) THREAD_CNT * (ITERATIONS + 2) * 2 + elapsed * 3;
+  if (switches > bound)
+    fail ("%lld context switches in %"PRId64" ticks, "
+          "expected at most %lld", switches, elapsed, bound);
+  msg ("Context switches within bound.");
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *done_) 
+{
+  struct semaphore *done = done_;
+  int duration = thread_tid () % 10 + 1;
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    timer_sleep (duration);
+  sema_up (done);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-bench) begin
+(alarm-bench) Creating 100 threads to sleep 10 times each.
+(alarm-bench) Thread N sleeps N % 10 + 1 ticks each time.
+(alarm-bench) Context switches within bound.
+(alarm-bench) end
+EOF
+pass;
@@ -0,0 +1,86 @@
+/* Checks that sema_down_timeout() and cond_wait_timeout() give up
+   after their timeouts when nothing wakes them, and return early
+   when something does. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static struct semaphore sema;
+static struct lock lock;
+static struct condition cond;
+
+static thread_func up_later;
+static thread_func signal_later;
+
+void
+test_alarm_timeout (void) 
+{
+  int64_t start;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&sema, 0);
+  start = timer_ticks ();
+  if (sema_down_timeout (&sema, 10))
+    fail ("sema_down_timeout() downed a semaphore nobody upped");
+  if (timer_elapsed (start) < 10)
+    fail ("sema_down_timeout() gave up after %"PRId64" ticks, not 10",
+          timer_elapsed (start));
+  msg ("sema_down_timeout() timed out.");
+
+  thread_create ("upper", PRI_DEFAULT, up_later, NULL);
+  start = timer_ticks ();
+  if (!sema_down_timeout (&sema, 100))
+    fail ("sema_down_timeout() missed sema_up()");
+  if (timer_elapsed (start) >= 100)
+    fail ("sema_down_timeout() waited out its timeout");
+  msg ("sema_down_timeout() returned on sema_up().");
+
+  lock_init (&lock);
+  cond_init (&cond);
+  lock_acquire (&lock);
+  start = timer_ticks ();
+  if (cond_wait_timeout (&cond, &lock, 10))
+    fail ("cond_wait_timeout() signaled with nobody signaling");
+  if (timer_elapsed (start) < 10)
+    fail ("cond_wait_timeout() gave up after %"PRId64" ticks, not 10",
+          timer_elapsed (start));
+  if (!lock_held_by_current_thread (&lock))
+    fail ("cond_wait_timeout() did not reacquire the lock");
+  if (!list_empty (&cond.waiters))
+    fail ("cond_wait_timeout() left its waiter behind");
+  msg ("cond_wait_timeout() timed out.");
+
+  thread_create ("signaler", PRI_DEFAULT, signal_later, NULL);
+  start = timer_ticks ();
+  if (!cond_wait_timeout (&cond, &lock, 100))
+    fail ("cond_wait_timeout() missed cond_signal()");
+  if (timer_elapsed (start) >= 100)
+    fail ("cond_wait_timeout() waited out its timeout");
+  lock_release (&lock);
+  msg ("cond_wait_timeout() returned on cond_signal().");
+}
+
+/* Ups the semaphore after a little while. */
+static void
+up_later (void *aux UNUSED) 
+{
+  timer_sleep (5);
+  sema_up (&sema);
+}
+
+/* Signals the condition after a little while. */
+static void
+signal_later (void *aux UNUSED) 
+{
+  timer_sleep (5);
+  lock_acquire (&lock);
+  cond_signal (&cond, &lock);
+  lock_release (&lock);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-timeout) begin
+(alarm-timeout) sema_down_timeout() timed out.
+(alarm-timeout) sema_down_timeout() returned on sema_up().
+(alarm-timeout) cond_wait_timeout() timed out.
+(alarm-timeout) cond_wait_timeout() returned on cond_signal().
+(alarm-timeout) end
+EOF
+pass;
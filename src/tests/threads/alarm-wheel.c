@@ -0,0 +1,240 @@
+/* Arms thousands of timeouts due at scattered times, some of them
+   far beyond the test's end, cancels or moves some, and checks
+   that each of the rest runs exactly at the tick it was due.
+
+   Then does the same on a timer wheel of its own, which it runs
+   through millions of ticks, with timeouts in the wheel's upper
+   levels and beyond its range, which are parked until they come
+   within it. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define TIMEOUT_CNT 5000        /* Number of timeouts. */
+#define SPAN 1000               /* Most ticks until one is due. */
+
+/* Timeouts on the test's own wheel. */
+#define FAR_CNT 600             /* Number of timeouts. */
+#define FAR_START 1000003       /* First tick the wheel runs. */
+#define LEVEL_2 ((int64_t) 1 << 12)     /* Least ticks for level 2. */
+#define LEVEL_3 ((int64_t) 1 << 18)     /* Least ticks for level 3. */
+#define PARKED ((int64_t) 1 << 24)      /* Least ticks to be parked. */
+#define FAR_SPAN (PARKED + ((int64_t) 1 << 22))  /* Most ticks. */
+
+/* A timeout under test. */
+struct wheel_test
+  {
+    struct timeout timeout;
+    int64_t due;                /* Tick it should run at. */
+    bool canceled;              /* Canceled, so it should not run. */
+    bool ran;                   /* Has run. */
+    bool late;                  /* Ran at the wrong tick. */
+  };
+
+static timeout_func expire;
+static timeout_func far_expire;
+static void test_far (void);
+
+/* The test's own wheel. */
+static struct timer_wheel *far_wheel;
+
+void
+test_alarm_wheel (void) 
+{
+  struct wheel_test *tests;
+  enum intr_level old_level;
+  int ran_cnt, canceled_cnt;
+  int i;
+
+  tests = malloc (sizeof *tests * TIMEOUT_CNT);
+  if (tests == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  msg ("Arming %d timeouts.", TIMEOUT_CNT);
+  old_level = intr_disable ();
+  for (i = 0; i < TIMEOUT_CNT; i++) 
+    {
+      struct wheel_test *t = tests + i;
+      int64_t ticks = i % 7 == 0 ? (int64_t) i << 12
+                                 : (int64_t) i * 7919 % SPAN + 1;
+
+      timeout_init (&t->timeout, expire, t);
+      timeout_arm (&t->timeout, ticks);
+      t->due = timer_ticks () + ticks;
+      t->canceled = i % 7 == 0 || i % 3 == 0;
+      t->ran = t->late = false;
+    }
+
+  /* Move some, cancel others, and cancel all the far ones. */
+  for (i = 0; i < TIMEOUT_CNT; i++) 
+    {
+      struct wheel_test *t = tests + i;
+
+      if (t->canceled)
+        timeout_cancel (&t->timeout);
+      else if (i % 5 == 0)
+        {
+          int64_t ticks = (int64_t) i * 31 % SPAN + 1;
+          timeout_arm (&t->timeout, ticks);
+          t->due = timer_ticks () + ticks;
+        }
+    }
+  intr_set_level (old_level);
+
+  msg ("Sleeping until all are due.");
+  timer_sleep (SPAN + 10);
+
+  ran_cnt = canceled_cnt = 0;
+  for (i = 0; i < TIMEOUT_CNT; i++) 
+    {
+      struct wheel_test *t = tests + i;
+
+      if (t->canceled)
+        {
+          if (t->ran)
+            fail ("canceled timeout %d ran", i);
+          canceled_cnt++;
+        }
+      else if (!t->ran)
+        fail ("timeout %d due at tick %"PRId64" did not run", i, t->due);
+      else if (t->late)
+        fail ("timeout %d due at tick %"PRId64" ran at the wrong tick",
+              i, t->due);
+      else
+        ran_cnt++;
+    }
+  msg ("%d timeouts ran on time, %d were canceled.", ran_cnt, canceled_cnt);
+
+  free (tests);
+
+  test_far ();
+}
+
+/* Returns the number of ticks until far timeout I is due: one of
+   the deltas at the edges of the wheel's levels and range, or
+   else one in level 2, in level 3, or beyond the range. */
+static int64_t
+far_ticks (int i) 
+{
+  static const int64_t edges[] =
+    {
+      LEVEL_2 - 1, LEVEL_2, LEVEL_3 - 1, LEVEL_3,
+      PARKED - 1, PARKED, PARKED + 1, FAR_SPAN,
+    };
+  const int edge_cnt = sizeof edges / sizeof *edges;
+
+  if (i < edge_cnt)
+    return edges[i];
+  switch (i % 3) 
+    {
+    case 0:
+      return LEVEL_2 + (int64_t) i * 7919 % (LEVEL_3 - LEVEL_2);
+    case 1:
+      return LEVEL_3 + (int64_t) i * 104729 % (PARKED - LEVEL_3);
+    default:
+      return PARKED + (int64_t) i * 1000003 % (FAR_SPAN - PARKED);
+    }
+}
+
+/* Arms FAR_CNT timeouts on a wheel of the test's own, cancels or
+   moves some, runs the wheel until all are due, and checks that
+   each of the rest ran exactly at the tick it was due. */
+static void
+test_far (void) 
+{
+  struct wheel_test *tests;
+  int ran_cnt, canceled_cnt;
+  int i;
+
+  tests = malloc (sizeof *tests * FAR_CNT);
+  far_wheel = timer_wheel_create (FAR_START);
+  if (tests == NULL || far_wheel == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  msg ("Arming %d timeouts on a wheel of our own.", FAR_CNT);
+  for (i = 0; i < FAR_CNT; i++) 
+    {
+      struct wheel_test *t = tests + i;
+      int64_t ticks = far_ticks (i);
+
+      timeout_init (&t->timeout, far_expire, t);
+      timer_wheel_arm (far_wheel, &t->timeout, ticks);
+      t->due = timer_wheel_now (far_wheel) + ticks;
+      t->canceled = i >= 8 && i % 5 == 0;
+      t->ran = t->late = false;
+    }
+
+  /* Cancel some, and move others after running the wheel a
+     while, so that they are armed off a tick that is not a
+     multiple of any level's span. */
+  for (i = 0; i < FAR_CNT; i++)
+    if (tests[i].canceled)
+      timeout_cancel (&tests[i].timeout);
+  timer_wheel_advance (far_wheel, LEVEL_2 + 77);
+  for (i = 8; i < FAR_CNT; i++) 
+    {
+      struct wheel_test *t = tests + i;
+
+      if (!t->canceled && i % 7 == 0)
+        {
+          int64_t ticks = far_ticks (FAR_CNT - i);
+          timer_wheel_arm (far_wheel, &t->timeout, ticks);
+          t->due = timer_wheel_now (far_wheel) + ticks;
+        }
+    }
+
+  msg ("Running the wheel until all are due.");
+  timer_wheel_advance (far_wheel, FAR_SPAN + 1);
+
+  ran_cnt = canceled_cnt = 0;
+  for (i = 0; i < FAR_CNT; i++) 
+    {
+      struct wheel_test *t = tests + i;
+
+      if (t->canceled)
+        {
+          if (t->ran)
+            fail ("canceled far timeout %d ran", i);
+          canceled_cnt++;
+        }
+      else if (!t->ran)
+        fail ("far timeout %d due at tick %"PRId64" did not run",
+              i, t->due);
+      else if (t->late)
+        fail ("far timeout %d due at tick %"PRId64" ran at the wrong tick",
+              i, t->due);
+      else
+        ran_cnt++;
+    }
+  msg ("%d timeouts ran on time, %d were canceled.", ran_cnt, canceled_cnt);
+
+  timer_wheel_destroy (far_wheel);
+  free (tests);
+}
+
+/* Records that the wheel_test T_ ran, and whether on time. */
+static void
+expire (void *t_) 
+{
+  struct wheel_test *t = t_;
+
+  t->ran = true;
+  t->late = timer_ticks () != t->due;
+}
+
+/* Records that the wheel_test T_ on the test's own wheel ran, and
+   whether on time. */
+static void
+far_expire (void *t_) 
+{
+  struct wheel_test *t = t_;
+
+  t->ran = true;
+  t->late = timer_wheel_now (far_wheel) != t->due;
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-wheel) begin
+(alarm-wheel) Arming 5000 timeouts.
+(alarm-wheel) Sleeping until all are due.
+(alarm-wheel) 2857 timeouts ran on time, 2143 were canceled.
+(alarm-wheel) Arming 600 timeouts on a wheel of our own.
+(alarm-wheel) Running the wheel until all are due.
+(alarm-wheel) 482 timeouts ran on time, 118 were canceled.
+(alarm-wheel) end
+EOF
+pass;
@@ -0,0 +1,97 @@
+/* Measures scheduling latency with hundreds of threads ready to
+   run.  The main thread wakes a high-priority thread over and
+   over; each wakeup must preempt the main thread at once, and
+   none of the many lower-priority ready threads may run in the
+   meantime.  The number of ticks taken is reported, so that
+   schedulers can be compared. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define FILLER_CNT 200          /* Number of lower-priority threads. */
+#define ROUND_CNT 1000          /* Number of wakeups. */
+
+static struct semaphore ping;   /* Upped to wake the waker. */
+static struct semaphore exited; /* Upped as each thread exits. */
+static int round_cnt;           /* Wakeups seen by the waker. */
+static int filler_runs;         /* Times a filler thread ran. */
+static bool done;               /* Tells the filler threads to exit. */
+
+static thread_func filler;
+static thread_func wakee;
+
+void
+test_priority_bench (void) 
+{
+  int64_t start, elapsed;
+  int runs;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  sema_init (&ping, 0);
+  sema_init (&exited, 0);
+  for (i = 0; i < FILLER_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "filler %d", i);
+      thread_create (name, PRI_MIN + 1 + i % (PRI_DEFAULT - PRI_MIN - 1),
+                     filler, NULL);
+    }
+  msg ("%d threads ready at lower priorities.", FILLER_CNT);
+
+  thread_create ("wakee", PRI_MAX, wakee, NULL);
+  runs = filler_runs;
+  start = timer_ticks ();
+  for (i = 0; i < ROUND_CNT; i++) 
+    {
+      sema_up (&ping);
+      if (round_cnt != i + 1)
+        fail ("wakeup %d did not preempt the waker", i);
+    }
+  elapsed = timer_elapsed (start);
+  if (filler_runs != runs)
+    fail ("lower-priority threads ran %d times", filler_runs - runs);
+  msg ("%d wakeups took %"PRId64" ticks.", ROUND_CNT, elapsed);
+  msg ("Each wakeup preempted immediately.");
+
+  /* Let the fillers run to completion. */
+  done = true;
+  for (i = 0; i < FILLER_CNT + 1; i++)
+    sema_down (&exited);
+}
+
+/* Keeps yielding until the test is done. */
+static void
+filler (void *aux UNUSED) 
+{
+  while (!done)
+    {
+      filler_runs++;
+      thread_yield ();
+    }
+  sema_up (&exited);
+}
+
+/* Counts wakeups, ROUND_CNT times. */
+static void
+wakee (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      sema_down (&ping);
+      round_cnt++;
+    }
+  sema_up (&exited);
+}
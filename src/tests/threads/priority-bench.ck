@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The time taken varies from run to run and is only reported.
+s/took \d+ ticks/took N ticks/ foreach @output;
+compare_output ("run", \@output, [<<'EOF']);
+(priority-bench) begin
+(priority-bench) 200 threads ready at lower priorities.
+(priority-bench) 1000 wakeups took N ticks.
+(priority-bench) Each wakeup preempted immediately.
+(priority-bench) end
+EOF
+pass;
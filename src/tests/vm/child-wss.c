@@ -0,0 +1,43 @@
+/* Child process of page-fair.
+   Encrypts 64 kB of zeros and decrypts it again, over and over,
+   checking each time that the zeros are back.  Its working set
+   stays small throughout. */
+
+#include <string.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+const char *test_name = "child-wss";
+
+#define SIZE (64 * 1024)
+#define ROUNDS 32
+
+static char buf[SIZE];
+
+int
+main (int argc, char *argv[])
+{
+  const char *key = argv[argc - 1];
+  struct arc4 arc4;
+  size_t i;
+  int round;
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      /* Encrypt zeros. */
+      arc4_init (&arc4, key, strlen (key));
+      arc4_crypt (&arc4, buf, SIZE);
+
+      /* Decrypt back to zeros. */
+      arc4_init (&arc4, key, strlen (key));
+      arc4_crypt (&arc4, buf, SIZE);
+
+      /* Check that it's all zeros. */
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != '\0')
+          fail ("byte %zu != 0 in round %d", i, round);
+    }
+
+  return 0x42;
+}
@@ -0,0 +1,27 @@
+/* Runs child-linear, which needs far more memory than it can
+   have, alongside 3 child-wss processes with small working sets.
+   The kernel is run with -vmstat, so that page-fair.ck can check
+   that the small processes did not lose their pages to the big
+   one. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 3
+
+void
+test_main (void)
+{
+  pid_t hog;
+  pid_t children[CHILD_CNT];
+  int i;
+
+  CHECK ((hog = exec ("child-linear")) != -1, "exec \"child-linear\"");
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK ((children[i] = exec ("child-wss")) != -1, "exec \"child-wss\"");
+
+  CHECK (wait (hog) == 0x42, "wait for child-linear");
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+}
@@ -0,0 +1,45 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+
+# Pull out the statistics that -vmstat makes each process print
+# on exit, and check the rest of the output as usual.
+my ($stats_re) = qr/^(\S+): \d+ resident \(peak \d+\), \d+ faults, (\d+) evictions$/;
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+my ($hog);
+my (@small);
+for my $line (@output) {
+    my ($name, $evictions) = $line =~ /$stats_re/ or next;
+    $hog = $evictions if $name eq 'child-linear';
+    push (@small, $evictions) if $name eq 'child-wss';
+}
+
+compare_output ("run", IGNORE_EXIT_CODES => 1,
+		[grep (!/$stats_re/, @output)], [<<'EOF']);
+(page-fair) begin
+(page-fair) exec "child-linear"
+(page-fair) exec "child-wss"
+(page-fair) exec "child-wss"
+(page-fair) exec "child-wss"
+(page-fair) wait for child-linear
+(page-fair) wait for child 0
+(page-fair) wait for child 1
+(page-fair) wait for child 2
+(page-fair) end
+EOF
+
+fail "child-linear printed no memory statistics\n" if !defined $hog;
+fail "only " . scalar (@small) . " child-wss processes printed "
+  . "memory statistics\n" if @small != 3;
+
+# The small processes should mostly have been left alone while
+# child-linear replaced its own pages.
+for my $evictions (@small) {
+    fail "child-wss lost $evictions frames, "
+      . "but child-linear only lost $hog\n" if $evictions * 4 > $hog;
+}
+pass;
@@ -0,0 +1,57 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+
+# Pull out the fault count that -vmstat makes the process print on
+# exit, and check the rest of the output as usual.
+my ($stats_re) = qr/^page-fault-flat-\d+: \d+ resident \(peak \d+\), (\d+) faults, \d+ evictions$/;
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+compare_output ("run", IGNORE_EXIT_CODES => 1,
+		[grep (!/$stats_re/, @output)], [<<'EOF']);
+(page-fault-flat-256) begin
+(page-fault-flat-256) write pass 0
+(page-fault-flat-256) read pass 0
+(page-fault-flat-256) write pass 1
+(page-fault-flat-256) read pass 1
+(page-fault-flat-256) write pass 2
+(page-fault-flat-256) read pass 2
+(page-fault-flat-256) write pass 3
+(page-fault-flat-256) read pass 3
+(page-fault-flat-256) end
+EOF
+
+# Returns the fault count and the timer ticks that the kernel
+# printed on shutdown, from the output of a run.
+sub flat_stats {
+    my ($faults, $ticks);
+    for my $line (@_) {
+	$faults = $1 if $line =~ /$stats_re/;
+	$ticks = $1 if $line =~ /^Timer: (\d+) ticks$/;
+    }
+    return ($faults, $ticks);
+}
+
+my ($small_test) = $test;
+$small_test =~ s/256$/64/;
+my ($faults, $ticks) = flat_stats (@output);
+my ($small_faults, $small_ticks)
+  = flat_stats (read_text_file ("$small_test.output"));
+
+fail "page-fault-flat-256 printed no statistics\n"
+  if !defined $faults || !defined $ticks;
+fail "page-fault-flat-64 printed no statistics\n"
+  if !defined $small_faults || !defined $small_ticks;
+
+# Every sweep should fault on every one of the 384 pages.
+fail "only $faults faults in 4 sweeps of 384 pages\n" if $faults < 4 * 384;
+
+# A fault should cost no more with the larger pool than with the
+# smaller one, within a factor of 2 for noise.
+fail "$faults faults took $ticks ticks with 256 frames, "
+  . "but $small_faults took $small_ticks with 64\n"
+  if $ticks * $small_faults > 2 * $small_ticks * $faults;
+pass;
@@ -0,0 +1,35 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+
+# Pull out the statistics that -vmstat makes the process print on
+# exit, and check the rest of the output as usual.
+my ($stats_re) = qr/^page-fault-flat-64: \d+ resident \(peak \d+\), (\d+) faults, \d+ evictions$/;
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+compare_output ("run", IGNORE_EXIT_CODES => 1,
+		[grep (!/$stats_re/, @output)], [<<'EOF']);
+(page-fault-flat-64) begin
+(page-fault-flat-64) write pass 0
+(page-fault-flat-64) read pass 0
+(page-fault-flat-64) write pass 1
+(page-fault-flat-64) read pass 1
+(page-fault-flat-64) write pass 2
+(page-fault-flat-64) read pass 2
+(page-fault-flat-64) write pass 3
+(page-fault-flat-64) read pass 3
+(page-fault-flat-64) end
+EOF
+
+my ($faults);
+for my $line (@output) {
+    $faults = $1 if $line =~ /$stats_re/;
+}
+fail "page-fault-flat-64 printed no memory statistics\n" if !defined $faults;
+
+# Every sweep should fault on every one of the 384 pages.
+fail "only $faults faults in 4 sweeps of 384 pages\n" if $faults < 4 * 384;
+pass;
@@ -0,0 +1,37 @@
+/* Sweeps a 1.5 MB buffer several times, touching one word per
+   page.  Built twice, as page-fault-flat-64 and
+   page-fault-flat-256, which run with user pools of 64 and 256
+   pages.  The buffer is bigger than either pool, so in both runs
+   every sweep faults on, and evicts for, every page.  Frame
+   lookups are by index into the frame table, so the cost of each
+   fault should not depend on the size of the pool.  The kernel
+   is run with -vmstat, so that page-fault-flat-256.ck can compare
+   the timer ticks per fault of the two runs. */
+
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 384
+#define PASSES 4
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  size_t pass, i;
+
+  for (pass = 0; pass < PASSES; pass++)
+    {
+      msg ("write pass %zu", pass);
+      for (i = 0; i < PAGE_CNT; i++)
+        *(uint32_t *) (buf + i * PAGE_SIZE) = i * PASSES + pass;
+
+      msg ("read pass %zu", pass);
+      for (i = 0; i < PAGE_CNT; i++)
+        if (*(uint32_t *) (buf + i * PAGE_SIZE) != i * PASSES + pass)
+          fail ("page %zu has wrong contents", i);
+    }
+}
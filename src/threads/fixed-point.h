@@ -0,0 +1,86 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed 17.14 fixed-point numbers, as used by the advanced
+   scheduler: 17 bits before the binary point, 14 after, in a
+   32-bit int.  Products and quotients of two fixed-point numbers
+   are computed in 64 bits so that they do not overflow on the
+   way. */
+typedef int32_t fixed_t;
+
+#define FIX_SHIFT 14
+#define FIX_ONE (1 << FIX_SHIFT)
+
+/* Returns integer N as a fixed-point number. */
+static inline fixed_t
+fix_int (int n)
+{
+  return n * FIX_ONE;
+}
+
+/* Returns X rounded toward zero to an integer. */
+static inline int
+fix_trunc (fixed_t x)
+{
+  return x / FIX_ONE;
+}
+
+/* Returns X rounded to the nearest integer. */
+static inline int
+fix_round (fixed_t x)
+{
+  return x >= 0 ? (x + FIX_ONE / 2) / FIX_ONE : (x - FIX_ONE / 2) / FIX_ONE;
+}
+
+/* Returns X + Y. */
+static inline fixed_t
+fix_add (fixed_t x, fixed_t y)
+{
+  return x + y;
+}
+
+/* Returns X + N, where N is an integer. */
+static inline fixed_t
+fix_add_int (fixed_t x, int n)
+{
+  return x + n * FIX_ONE;
+}
+
+/* Returns X - Y. */
+static inline fixed_t
+fix_sub (fixed_t x, fixed_t y)
+{
+  return x - y;
+}
+
+/* Returns X * Y. */
+static inline fixed_t
+fix_mul (fixed_t x, fixed_t y)
+{
+  return (int64_t) x * y / FIX_ONE;
+}
+
+/* Returns X * N, where N is an integer. */
+static inline fixed_t
+fix_mul_int (fixed_t x, int n)
+{
+  return x * n;
+}
+
+/* Returns X / Y. */
+static inline fixed_t
+fix_div (fixed_t x, fixed_t y)
+{
+  return (int64_t) x * FIX_ONE / y;
+}
+
+/* Returns X / N, where N is an integer. */
+static inline fixed_t
+fix_div_int (fixed_t x, int n)
+{
+  return x / n;
+}
+
+#endif /* threads/fixed-point.h */
@@ -40,6 +40,7 @@
 #ifdef VM
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/share.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -134,6 +135,7 @@ main (void)
 #ifdef VM
   /* Initialize virtual memory. */
   frame_init ();
+  share_init ();
   init_swap_structures ();
 #endif
 
@@ -269,6 +271,12 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-fra"))
+        file_read_ahead = atoi (value);
+      else if (!strcmp (name, "-vmstat"))
+        process_vm_stats = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -391,6 +399,10 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -fra=COUNT         Read ahead up to COUNT pages on file faults.\n"
+          "  -vmstat            Print memory statistics of processes on exit.\n"
 #endif
           );
   shutdown_power_off ();
@@ -29,9 +29,15 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Most threads that one waiter donates its priority through: the
+   holder of the lock or reader/writer lock it waits for, the
+   holder of the one that that holder waits for, and so on. */
+#define DONATION_DEPTH 8
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -75,6 +81,79 @@ sema_down (struct semaphore *sema)
   intr_set_level (old_level);
 }
 
+/* A thread waiting in sema_down_timeout(). */
+struct sema_waiter
+  {
+    struct thread *thread;      /* The waiting thread. */
+    bool timed_out;             /* Has the wait timed out? */
+  };
+
+static timeout_func sema_wait_expire;
+static list_less_func thread_priority_less;
+static list_less_func waiter_priority_less;
+static void donate_priority (struct thread *);
+static int cond_max_priority (struct condition *);
+static void rwlock_wait (struct rwlock *, struct condition *);
+static void rwlock_set_writer (struct rwlock *, struct thread *);
+
+/* Down or "P" operation on a semaphore, but gives up if SEMA's
+   value does not become positive within TICKS timer ticks.
+   Returns true if the semaphore is decremented, false if the
+   wait timed out.  If TICKS is not positive, this is the same as
+   sema_try_down().
+
+   This function may sleep, so it must not be called within an
+   interrupt handler.  This function may be called with
+   interrupts disabled, but if it sleeps then the next scheduled
+   thread will probably turn interrupts back on. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t ticks)
+{
+  struct sema_waiter waiter;
+  struct timeout timeout;
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (sema != NULL);
+  ASSERT (!intr_context ());
+
+  waiter.thread = thread_current ();
+  waiter.timed_out = ticks <= 0;
+  timeout_init (&timeout, sema_wait_expire, &waiter);
+
+  old_level = intr_disable ();
+  if (sema->value == 0 && !waiter.timed_out)
+    timeout_arm (&timeout, ticks);
+  while (sema->value == 0 && !waiter.timed_out)
+    {
+      list_push_back (&sema->waiters, &waiter.thread->elem);
+      thread_block ();
+    }
+  success = sema->value > 0;
+  if (success)
+    sema->value--;
+  timeout_cancel (&timeout);
+  intr_set_level (old_level);
+
+  return success;
+}
+
+/* Ends the wait of the sema_waiter WAITER_.  If sema_up() has not
+   already woken the thread, takes it off the semaphore's wait
+   list and wakes it.  Runs in the timer interrupt handler. */
+static void
+sema_wait_expire (void *waiter_)
+{
+  struct sema_waiter *waiter = waiter_;
+
+  waiter->timed_out = true;
+  if (waiter->thread->status == THREAD_BLOCKED)
+    {
+      list_remove (&waiter->thread->elem);
+      thread_unblock (waiter->thread);
+    }
+}
+
 /* Down or "P" operation on a semaphore, but only if the
    semaphore is not already 0.  Returns true if the semaphore is
    decremented, false otherwise.
@@ -102,7 +181,10 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.  Priorities can change through donation while
+   threads wait, so the waiters are not kept sorted; the highest
+   is looked for here instead.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,10 +196,28 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct list_elem *e = list_max (&sema->waiters,
+                                      thread_priority_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Returns true if thread A has lower priority than thread B.
+   Among equals, list_max() picks the first, so waiters of equal
+   priority are woken in the order they came. */
+static bool
+thread_priority_less (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority < b->priority;
 }
 
 static void sema_test_helper (void *sema_);
@@ -185,6 +285,10 @@ lock_init (struct lock *lock)
    necessary.  The lock must not already be held by the current
    thread.
 
+   While we wait, the holder runs with at least our priority, and
+   so does whatever thread holds a lock that the holder waits for,
+   and so on down the chain, up to DONATION_DEPTH threads deep.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -192,12 +296,51 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      cur->waiting_lock = lock;
+      donate_priority (cur);
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  list_push_back (&cur->held_locks, &lock->elem);
+  intr_set_level (old_level);
+}
+
+/* Raises the priority of the thread holding the lock or
+   reader/writer lock that CUR is about to wait for to CUR's, and
+   on down the chain of holders, up to DONATION_DEPTH threads
+   deep.  Interrupts must be off. */
+static void
+donate_priority (struct thread *cur)
+{
+  struct thread *t = cur;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < DONATION_DEPTH; depth++)
+    {
+      struct thread *holder = NULL;
+
+      if (t->waiting_lock != NULL)
+        holder = t->waiting_lock->holder;
+      else if (t->waiting_rwlock != NULL)
+        holder = t->waiting_rwlock->writer;
+      if (holder == NULL || holder->priority >= cur->priority)
+        break;
+      thread_donate_priority (holder, cur->priority);
+      t = holder;
+    }
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -209,18 +352,26 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      list_push_back (&lock->holder->held_locks, &lock->elem);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Gives up whatever priority was donated through LOCK, and
+   yields if one of its waiters now has the higher priority.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -228,11 +379,20 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   lock->holder = NULL;
+  list_remove (&lock->elem);
+  if (!thread_mlfqs)
+    thread_refresh_priority (cur);
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+  thread_preempt ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -251,6 +411,7 @@ struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -295,12 +456,49 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
 
+/* Like cond_wait(), but gives up waiting for a signal after
+   TICKS timer ticks.  Returns true if COND was signaled, false if
+   the wait timed out.  Either way, LOCK is held again on return.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+cond_wait_timeout (struct condition *cond, struct lock *lock, int64_t ticks)
+{
+  struct semaphore_elem waiter;
+  bool signaled;
+
+  ASSERT (cond != NULL);
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+  
+  sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
+  list_push_back (&cond->waiters, &waiter.elem);
+  lock_release (lock);
+  signaled = sema_down_timeout (&waiter.semaphore, ticks);
+  lock_acquire (lock);
+
+  /* A signal may have come in between the timeout and our getting
+     LOCK back.  If not, we are still on COND's list. */
+  if (!signaled)
+    {
+      if (sema_try_down (&waiter.semaphore))
+        signaled = true;
+      else
+        list_remove (&waiter.elem);
+    }
+  return signaled;
+}
+
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -317,8 +515,44 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_max (&cond->waiters,
+                                      waiter_priority_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
+}
+
+/* Returns true if the thread waiting on semaphore_elem A has
+   lower priority than the one waiting on semaphore_elem B. */
+static bool
+waiter_priority_less (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct semaphore_elem *a
+    = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b
+    = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority < b->thread->priority;
+}
+
+/* Returns the highest priority of the threads waiting on COND,
+   or PRI_MIN if there are none.  Interrupts must be off. */
+static int
+cond_max_priority (struct condition *cond)
+{
+  struct list_elem *e;
+  int priority = PRI_MIN;
+
+  for (e = list_begin (&cond->waiters); e != list_end (&cond->waiters);
+       e = list_next (e))
+    {
+      struct semaphore_elem *w = list_entry (e, struct semaphore_elem, elem);
+      if (w->thread->priority > priority)
+        priority = w->thread->priority;
+    }
+  return priority;
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -336,3 +570,159 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK.  A reader/writer lock can be held either
+   by any number of readers at once or by a single writer.  Like
+   locks, reader/writer locks are not recursive.
+
+   Waiting writers take precedence over new readers, so that a
+   steady stream of readers cannot starve a writer.  A writer gets
+   the priority of the threads waiting for it, as the holder of a
+   lock does.  Readers are not tracked, so they get none. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers);
+  cond_init (&rw->writers);
+  rw->reader_cnt = 0;
+  rw->waiting_writers = 0;
+  rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rw));
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->waiting_writers > 0)
+    rwlock_wait (rw, &rw->readers);
+  rw->reader_cnt++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->reader_cnt > 0);
+  if (--rw->reader_cnt == 0)
+    cond_signal (&rw->writers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.  RW must not already be held by the current thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rw));
+
+  lock_acquire (&rw->lock);
+  rw->waiting_writers++;
+  while (rw->writer != NULL || rw->reader_cnt > 0)
+    rwlock_wait (rw, &rw->writers);
+  rw->waiting_writers--;
+  rwlock_set_writer (rw, thread_current ());
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for writing.
+   The next waiting writer goes first, otherwise all waiting
+   readers enter together. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_for_write (rw));
+
+  lock_acquire (&rw->lock);
+  rwlock_set_writer (rw, NULL);
+  if (rw->waiting_writers > 0)
+    cond_signal (&rw->writers, &rw->lock);
+  else
+    cond_broadcast (&rw->readers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise. */
+bool
+rwlock_held_for_write (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* Returns the highest priority of the threads waiting for RW, or
+   PRI_MIN if there are none.  Interrupts must be off. */
+int
+rwlock_waiter_priority (struct rwlock *rw)
+{
+  int readers = cond_max_priority (&rw->readers);
+  int writers = cond_max_priority (&rw->writers);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  return readers > writers ? readers : writers;
+}
+
+/* Waits on COND, one of RW's condition variables, donating the
+   current thread's priority to RW's writer meanwhile.  RW's lock
+   must be held. */
+static void
+rwlock_wait (struct rwlock *rw, struct condition *cond)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (rw->writer != NULL && !thread_mlfqs)
+    {
+      cur->waiting_rwlock = rw;
+      donate_priority (cur);
+    }
+  intr_set_level (old_level);
+
+  cond_wait (cond, &rw->lock);
+  cur->waiting_rwlock = NULL;
+}
+
+/* Makes WRITER, or nobody if it is a null pointer, the thread
+   holding RW for writing.  A new writer takes on the priority of
+   the threads already waiting; an old one gives up what they
+   donated.  RW's lock must be held. */
+static void
+rwlock_set_writer (struct rwlock *rw, struct thread *writer)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (rw->writer != NULL)
+    list_remove (&rw->elem);
+  rw->writer = writer;
+  if (writer != NULL)
+    list_push_back (&writer->held_rwlocks, &rw->elem);
+  if (!thread_mlfqs)
+    thread_refresh_priority (thread_current ());
+  intr_set_level (old_level);
+}
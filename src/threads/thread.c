@@ -4,6 +4,8 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "threads/fixed-point.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -23,9 +25,15 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, with one queue per
+   priority.  Bit N of ready_bitmap is set whenever the queue for
+   priority N is nonempty, so that the highest nonempty queue can
+   be found in constant time.  Only touched with interrupts
+   off. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static int ready_cnt;           /* Number of threads in the queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -52,6 +60,7 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long switch_cnt;    /* # of context switches. */
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
@@ -62,11 +71,31 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Advanced scheduler.  Each thread's priority depends only on
+   its niceness and its recent_cpu, and between the once-a-second
+   updates only the running thread's recent_cpu changes.  So every
+   PRIORITY_INTERVAL ticks only the running thread's priority is
+   recalculated, which takes constant time.  The once-a-second
+   update still decays every thread's recent_cpu and requeues it,
+   so that one tick costs time linear in the number of threads. */
+#define NICE_MIN -20                    /* Lowest niceness. */
+#define NICE_MAX 20                     /* Highest niceness. */
+#define PRIORITY_INTERVAL 4             /* Ticks between updates. */
+static fixed_t load_avg;                /* System load average. */
+
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update (struct thread *, void *aux);
+static int mlfqs_priority (const struct thread *);
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static void set_priority (struct thread *, int priority);
+static int ready_max_priority (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
@@ -90,10 +119,13 @@ static tid_t allocate_tid (void);
 void
 thread_init (void)
 {
+  int pri;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init (&ready_queues[pri]);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -137,6 +169,9 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
@@ -148,6 +183,17 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld context switches\n", switch_cnt);
+}
+
+/* Returns the number of context switches since boot. */
+long long
+thread_switch_cnt (void)
+{
+  enum intr_level old_level = intr_disable ();
+  long long cnt = switch_cnt;
+  intr_set_level (old_level);
+  return cnt;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -160,11 +206,9 @@ thread_print_stats (void)
    before thread_create() returns.  Contrariwise, the original
    thread may run for any amount of time before the new thread is
    scheduled.  Use a semaphore or some other form of
-   synchronization if you need to ensure ordering.
-
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   synchronization if you need to ensure ordering.  In
+   particular, if PRIORITY is higher than the running thread's,
+   the new thread runs before thread_create() returns. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux)
@@ -240,10 +284,11 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, the
+   running thread is preempted, but only once interrupts are on:
+   if the caller had disabled interrupts itself, it may expect
+   that it can atomically unblock a thread and update other data,
+   and it should call thread_preempt() once it is done. */
 void
 thread_unblock (struct thread *t)
 {
@@ -253,9 +298,40 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
+
+  thread_preempt ();
+}
+
+/* Yields the CPU if a thread of higher priority than the running
+   thread is ready to run.  In an interrupt handler, the yield
+   happens on return from the interrupt.  With interrupts off
+   outside an interrupt handler, it does not happen at all, so
+   that the caller's critical section stays atomic. */
+void
+thread_preempt (void)
+{
+  struct thread *cur = running_thread ();
+  enum intr_level old_level;
+  bool yield;
+
+  if (!intr_context () && intr_get_level () == INTR_OFF)
+    return;
+
+  old_level = intr_disable ();
+  yield = ready_bitmap != 0
+          && (cur == idle_thread || ready_max_priority () > cur->priority);
+  intr_set_level (old_level);
+
+  if (yield)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
 }
 
 /* Returns the name of the running thread. */
@@ -323,7 +399,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread)
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -346,11 +422,77 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.  Its
+   priority stays as high as any donated to it.  Yields if that
+   leaves a ready thread with a higher priority. */
 void
 thread_set_priority (int new_priority)
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  /* The advanced scheduler sets priorities itself. */
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_refresh_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
+}
+
+/* Raises T's priority to PRIORITY, if it is lower, on behalf of a
+   thread waiting for a lock that T holds.  Interrupts must be
+   off. */
+void
+thread_donate_priority (struct thread *t, int priority)
+{
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority > t->priority)
+    set_priority (t, priority);
+}
+
+/* Recomputes T's priority as the greater of its base priority
+   and the priorities of the threads waiting for locks and
+   reader/writer locks that it holds.  Interrupts must be off. */
+void
+thread_refresh_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e, *f;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      struct list *waiters = &lock->semaphore.waiters;
+
+      for (f = list_begin (waiters); f != list_end (waiters);
+           f = list_next (f))
+        {
+          struct thread *waiter = list_entry (f, struct thread, elem);
+          if (waiter->priority > priority)
+            priority = waiter->priority;
+        }
+    }
+  for (e = list_begin (&t->held_rwlocks); e != list_end (&t->held_rwlocks);
+       e = list_next (e))
+    {
+      struct rwlock *rw = list_entry (e, struct rwlock, elem);
+      int waiter_priority = rwlock_waiter_priority (rw);
+      if (waiter_priority > priority)
+        priority = waiter_priority;
+    }
+  set_priority (t, priority);
 }
 
 /* Returns the current thread's priority. */
@@ -360,35 +502,112 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, recalculates its
+   priority, and yields if it no longer has the highest. */
 void
-thread_set_nice (int nice UNUSED)
+thread_set_nice (int nice)
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (nice < NICE_MIN)
+    nice = NICE_MIN;
+  else if (nice > NICE_MAX)
+    nice = NICE_MAX;
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    cur->priority = cur->base_priority = mlfqs_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fix_round (fix_mul_int (load_avg, 100));
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = fix_round (fix_mul_int (thread_current ()->recent_cpu, 100));
+  intr_set_level (old_level);
+  return recent;
+}
+
+/* Does the advanced scheduler's work for timer tick with thread
+   CUR running.  Runs in the timer interrupt handler. */
+static void
+mlfqs_tick (struct thread *cur)
+{
+  int64_t ticks = timer_ticks ();
+
+  if (cur != idle_thread)
+    cur->recent_cpu = fix_add_int (cur->recent_cpu, 1);
+
+  if (ticks % TIMER_FREQ == 0)
+    {
+      int ready = ready_cnt + (cur != idle_thread ? 1 : 0);
+      fixed_t twice_load, decay;
+
+      load_avg = fix_add (fix_div_int (fix_mul_int (load_avg, 59), 60),
+                          fix_div_int (fix_int (ready), 60));
+      twice_load = fix_mul_int (load_avg, 2);
+      decay = fix_div (twice_load, fix_add_int (twice_load, 1));
+      thread_foreach (mlfqs_update, &decay);
+    }
+  else if (ticks % PRIORITY_INTERVAL == 0 && cur != idle_thread)
+    cur->priority = cur->base_priority = mlfqs_priority (cur);
+
+  if (ready_bitmap != 0
+      && (cur == idle_thread || ready_max_priority () > cur->priority))
+    intr_yield_on_return ();
+}
+
+/* Decays T's recent_cpu by the factor pointed to by DECAY_ and
+   recalculates its priority.  Called once a second for every
+   thread. */
+static void
+mlfqs_update (struct thread *t, void *decay_)
+{
+  fixed_t *decay = decay_;
+
+  if (t == idle_thread)
+    return;
+  t->recent_cpu = fix_add_int (fix_mul (*decay, t->recent_cpu), t->nice);
+  set_priority (t, mlfqs_priority (t));
+  t->base_priority = t->priority;
+}
+
+/* Returns the priority the advanced scheduler gives T. */
+static int
+mlfqs_priority (const struct thread *t)
+{
+  int priority = PRI_MAX - fix_trunc (fix_div_int (t->recent_cpu, 4))
+                 - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  else if (priority > PRI_MAX)
+    return PRI_MAX;
+  else
+    return priority;
 }
 
 #ifdef USERPROG
@@ -505,7 +724,21 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  if (thread_mlfqs)
+    {
+      /* A new thread starts out as nice as its creator, and with
+         its creator's recent_cpu. */
+      if (t != initial_thread)
+        {
+          struct thread *parent = running_thread ();
+          t->nice = parent->nice;
+          t->recent_cpu = parent->recent_cpu;
+        }
+      priority = mlfqs_priority (t);
+    }
+  t->priority = t->base_priority = priority;
+  list_init (&t->held_locks);
+  list_init (&t->held_rwlocks);
   t->magic = THREAD_MAGIC;
 
 #ifdef USERPROG
@@ -537,18 +770,92 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
+/* Chooses and returns the next thread to be scheduled: the
+   thread at the front of the highest-priority nonempty run
+   queue.  (If the running thread can continue running, then it
+   will be in a run queue.)  If the run queues are empty, return
    idle_thread. */
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  struct list *queue;
+  struct thread *t;
+  int pri;
+
+  if (ready_bitmap == 0)
     return idle_thread;
+
+  pri = ready_max_priority ();
+  queue = &ready_queues[pri];
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  if (list_empty (queue))
+    ready_bitmap &= ~((uint64_t) 1 << pri);
+  ready_cnt--;
+  return t;
+}
+
+/* Adds T to the back of the run queue for its priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_bitmap |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Takes ready thread T off its run queue.  Interrupts must be
+   off. */
+static void
+ready_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_bitmap &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/* Sets T's priority to PRIORITY, moving T to the matching run
+   queue if it is ready.  Interrupts must be off. */
+static void
+set_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority == t->priority)
+    return;
+  if (t->status == THREAD_READY && t != idle_thread)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    t->priority = priority;
+}
+
+/* Returns the highest priority with a ready thread.  Interrupts
+   must be off and some thread must be ready.  The bitmap is
+   searched one 32-bit half at a time, so that the search
+   compiles to a single bit-scan instruction without help from
+   libgcc. */
+static int
+ready_max_priority (void)
+{
+  uint32_t high = ready_bitmap >> 32;
+  uint32_t low = ready_bitmap;
+
+  ASSERT (ready_bitmap != 0);
+
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else
+    return 31 - __builtin_clz (low);
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -616,7 +923,10 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      switch_cnt++;
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
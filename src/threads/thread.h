@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
 #include <hash.h>
 
@@ -35,6 +36,14 @@ enum loaded_status
 typedef int tid_t;
 #define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
 
+#ifdef VM
+/* Most pages read ahead from swap after a swap fault. */
+#define READ_AHEAD_MAX 8
+
+/* Default limit on the size of a process's stack. */
+#define MAXSIZE 0x800000 /* 8 MB max stack size. */
+#endif
+
 /* Thread priorities. */
 #define PRI_MIN 0                       /* Lowest priority. */
 #define PRI_DEFAULT 31                  /* Default priority. */
@@ -103,10 +112,25 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including
+                                           donations. */
+    int base_priority;                  /* Priority before donations. */
     struct list_elem allelem;           /* List element for all threads
                                            list. */
 
+    /* Used by the advanced scheduler in thread.c. */
+    int nice;                           /* Niceness. */
+    fixed_t recent_cpu;                 /* Recent CPU time used. */
+
+    /* Shared between thread.c and synch.c for priority donation. */
+    struct list held_locks;             /* Locks held. */
+    struct lock *waiting_lock;          /* Lock being waited for, if
+                                           any. */
+    struct list held_rwlocks;           /* Reader/writer locks held for
+                                           writing. */
+    struct rwlock *waiting_rwlock;      /* Reader/writer lock being
+                                           waited for, if any. */
+
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
@@ -124,6 +148,19 @@ struct thread
     struct file *executable;            /* Keep track of the executing file */
 
     struct list open_fds;               /* Used to close fds on exit call. */
+
+    /* Used by userprog/syscall.c and userprog/exception.c. */
+    bool user_copy;                     /* In a fault-safe access to user
+                                           memory? */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Working directory, or a null
+                                           pointer for the root. */
+
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal operations. */
 #endif
 
 #ifdef VM
@@ -134,6 +171,30 @@ struct thread
     /* Used by userprog/syscall.c. */
     struct hash file_map;               /* Maps mapids to files. */
     int next_mapid;                     /* Used in mapid allocation. */
+
+    /* Used by userprog/exception.c for swap read-ahead. */
+    void *ra_last_fault;                /* Page of the last swap fault. */
+    int ra_window;                      /* # of pages to read ahead. */
+    void *ra_pages[READ_AHEAD_MAX];     /* Pages read ahead last time. */
+    void *exe_next_fault;               /* Page after the last executable
+                                           page faulted in. */
+
+    /* Used by userprog/exception.c for stack growth. */
+    void *user_esp;                     /* User stack pointer on entry to
+                                           the last system call. */
+    size_t stack_limit;                 /* Most bytes the stack may grow
+                                           to. */
+
+    /* Used by vm/frame.c for working sets and frame quotas. */
+    size_t resident;                    /* # of frames owned. */
+    size_t resident_peak;               /* Most frames ever owned. */
+    size_t frame_quota;                 /* Soft limit on frames owned. */
+    size_t working_set;                 /* # of pages used in the last
+                                           sample interval. */
+    long long fault_cnt;                /* # of page faults. */
+    long long evict_cnt;                /* # of frames evicted from. */
+    int64_t sample_tick;                /* Tick of the last sample. */
+    long long sample_fault_cnt;         /* fault_cnt at the last sample. */
 #endif
 
     /* Owned by thread.c. */
@@ -169,12 +230,16 @@ void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+long long thread_switch_cnt (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_preempt (void);
+void thread_donate_priority (struct thread *, int priority);
+void thread_refresh_priority (struct thread *);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
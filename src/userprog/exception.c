@@ -11,6 +11,7 @@
 #include "vm/frame.h"
 #include "vm/swap.h"
 #include "vm/mmap.h"
+#include "vm/share.h"
 #include "filesys/file.h"
 #include "userprog/pagedir.h"
 #include <string.h>
@@ -20,8 +21,33 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* Swap read-ahead statistics. */
+static long long read_ahead_cnt;        /* # of pages read ahead. */
+static long long read_ahead_hit_cnt;    /* # of those that were used. */
+
+/* Number of pages to read ahead on a file-backed page fault, when faults
+   on that executable or mapping have been sequential. */
+int file_read_ahead = 8;
+
+/* Number of pages read ahead on file-backed page faults. */
+static long long file_read_ahead_cnt;
+
+/* Zero page statistics. */
+static long long zero_map_cnt;          /* # of faults given the zero page. */
+static long long copy_on_write_cnt;     /* # of those later written to. */
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void swap_in (struct thread *, struct sup_page *);
+static void swap_read_ahead (struct thread *, uint8_t *upage);
+static void load_file_pages (struct thread *, struct sup_page *);
+static void load_mapped_pages (struct thread *, struct mapping *,
+                               uint8_t *upage);
+static size_t read_ahead_window (uint8_t *upage, void *next_fault);
+static void map_zero_page (struct thread *, uint8_t *upage, bool write);
+static bool copy_on_write (struct thread *, uint8_t *upage);
+static bool is_stack_access (struct thread *, void *fault_addr, void *esp);
+static void grow_stack (struct thread *, uint8_t *upage, bool write);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -77,6 +103,12 @@ void
 exception_print_stats (void)
 {
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+  printf ("Exception: %lld pages read ahead from swap, %lld used\n",
+          read_ahead_cnt, read_ahead_hit_cnt);
+  printf ("Exception: %lld pages read ahead from files\n",
+          file_read_ahead_cnt);
+  printf ("Exception: %lld zero page mappings, %lld copied on write\n",
+          zero_map_cnt, copy_on_write_cnt);
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -139,7 +171,7 @@ page_fault (struct intr_frame *f)
   bool write;        /* True: access was write, false: access was read. */
   bool user;         /* True: access by user, false: access by kernel. */
   void *fault_addr;  /* Fault address. */
-  void *stack_pointer = f->esp;
+  void *stack_pointer;
 
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -154,14 +186,21 @@ page_fault (struct intr_frame *f)
      be assured of reading CR2 before it changed). */
   intr_enable ();
 
-  /* Count page faults. */
+  /* Count page faults, and charge faults on user memory to the process
+     for its frame quota. */
   page_fault_cnt++;
+  if (is_user_vaddr (fault_addr) && thread_current ()->pagedir != NULL)
+    frame_note_fault (thread_current ());
 
   /* Determine cause. */
   not_present = (f->error_code & PF_P) == 0;
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* F's esp is only the user stack pointer if the fault came from user
+     code. For a fault in a system call, use the one saved on entry. */
+  stack_pointer = user ? f->esp : thread_current ()->user_esp;
+
   if (not_present)
     {
       struct thread *cur = thread_current ();
@@ -171,115 +210,80 @@ page_fault (struct intr_frame *f)
 
       if (page != NULL && !page->is_loaded && is_user_vaddr (fault_addr))
         {
-          uint8_t *frame = NULL;
-
           switch (page->type)
             {
               case FILE:
-                /* Page data is in the file system */
-                frame = allocate_frame (PAL_USER);
-
-                /* The file-system lock will only be acquired if current
-                   thread does not hold it. This prevents issues when coming
-                   from a read system call. */
-
-                pin_frame_by_page (frame);
-                lock_filesystem ();
-                file_seek (page->file, page->offset);
-                if (file_read (page->file, frame, page->read_bytes) !=
-                    (int) page->read_bytes)
-                  free_frame (frame);
-
-                release_filesystem ();
-
-                memset (frame + page->read_bytes, 0, page->zero_bytes);
-                unpin_frame_by_page (frame);
-
-                /* Add the frame with its new data to the page directory of
-                   the current thread */
-                lock_acquire (&cur->pd_lock);
-                if (!pagedir_set_page (cur->pagedir, page->user_addr, frame,
-                                       page->writable))
-                  free_frame (frame);
+                /* Pages with nothing to read are all zeros */
+                if (page->read_bytes == 0)
+                  {
+                    map_zero_page (cur, page->user_addr,
+                                   write && page->writable);
+                    page->is_loaded = true;
+                    break;
+                  }
 
-                lock_release (&cur->pd_lock);
+                /* Page data is in the file system, along with the pages
+                   that follow it */
+                load_file_pages (cur, page);
+                break;
 
+              case ZERO:
+                map_zero_page (cur, page->user_addr, write);
                 page->is_loaded = true;
                 break;
 
               case FILEINSWAP:
+              case ZEROINSWAP:
               case SWAP:
-                /* Page data is in a swap slot */
-                frame = allocate_frame (PAL_USER);
-
-                lock_acquire (&cur->pd_lock);
-                if (!pagedir_set_page (cur->pagedir, page->user_addr, frame,
-                                       page->swap_writable))
-                  free_frame (frame);
-
-                lock_release (&cur->pd_lock);
-
-                /* Load the data into the frame from the swap slot */
-                pin_frame_by_page (frame);
-                free_slot (page->user_addr, page->swap_index);
-                unpin_frame_by_page (frame);
-
-                /* If the page was just a swap page then we can delete it
-                   since its only purpose was to reference a frame with swap
-                   swap data. If it was file data in swap, then mark it as a
-                   loaded file */
-                if (page->type == SWAP)
-                  hash_delete (&cur->supp_pt, &page->pt_elem);
-                else if (page->type == (FILEINSWAP))
-                  {
-                    page->type = FILE;
-                    page->is_loaded = true;
-                  }
+                /* Page data is in a swap slot. Bring in its neighbours
+                   too, while the swap device is busy with this region */
+                swap_in (cur, page);
+                swap_read_ahead (cur, pg_round_down (fault_addr));
                 break;
             }
 
           return;
         }
       /* Stack needs expanding. */
-      else if (page == NULL &&
-               stack_pointer - 32 <= fault_addr &&
-               PHYS_BASE - fault_addr - PGSIZE < MAXSIZE)
+      else if (page == NULL && is_stack_access (cur, fault_addr,
+                                                stack_pointer))
         {
-          void *new_frame = allocate_frame (PAL_USER | PAL_ZERO);
-          pagedir_set_page (cur->pagedir, pg_round_down (fault_addr),
-                            new_frame, true);
+          grow_stack (cur, pg_round_down (fault_addr), write);
           return;
         }
       /* Memory mapped file. */
       else if (page == NULL && is_mapped (fault_addr))
         {
-          /* Read the relevant data from the file and copy it into a new
-             page. */
-
-          page = create_sup_page (NULL, 0, PGSIZE, true,
-                                  pg_round_down (fault_addr), 0);
-
+          /* Read the relevant data from the file and copy it into new
+             pages. */
           struct mapping *m = addr_to_map (fault_addr);
 
           ASSERT (m != NULL);
 
-          void *frame = allocate_frame (PAL_USER | PAL_ZERO);
-          int offset = pg_round_down (fault_addr) - m->addr;
-
-          lock_filesystem ();
-          file_read_at (m->file, frame, PGSIZE, offset);
-          release_filesystem ();
-
-          pagedir_set_page (cur->pagedir, page->user_addr, frame,
-                            page->writable);
-
+          load_mapped_pages (cur, m, pg_round_down (fault_addr));
           return;
         }
     }
 
-  /* Kernel trying to write to user address space. */
-  if (!user && write && is_user_vaddr (fault_addr))
+  /* Write to the zero page. This may come from the kernel, writing into a
+     user buffer. */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && copy_on_write (thread_current (), pg_round_down (fault_addr)))
+    return;
+
+  /* Kernel trying to access a bad user address on behalf of a system
+     call. In get_user() or put_user(), which hold the address to resume
+     at in EAX, make the access fail with EAX set to -1, so that the
+     caller can give up whatever it holds. Anywhere else, kill the
+     process, not the kernel. */
+  if (!user && is_user_vaddr (fault_addr))
     {
+      if (thread_current ()->user_copy)
+        {
+          f->eip = (void (*) (void)) f->eax;
+          f->eax = 0xffffffff;
+          return;
+        }
       exit (-1);
     }
 
@@ -290,3 +294,342 @@ page_fault (struct intr_frame *f)
           user ? "user" : "kernel");
   kill (f);
 }
+
+/* Bring PAGE of thread CUR in from its swap slot and map it. */
+static void
+swap_in (struct thread *cur, struct sup_page *page)
+{
+  uint8_t *frame = allocate_frame (PAL_USER);
+
+  lock_acquire (&cur->pd_lock);
+  if (!pagedir_set_page (cur->pagedir, page->user_addr, frame,
+                         page->swap_writable))
+    free_frame (frame);
+
+  lock_release (&cur->pd_lock);
+
+  /* Load the data into the frame from the swap slot. We write through the
+     kernel's mapping of the frame, so mark the page dirty ourselves: its
+     contents differ from anything that could be reloaded from a file */
+  pin_frame_by_page (frame);
+  free_slot (frame, page->swap_index);
+  lock_acquire (&cur->pd_lock);
+  pagedir_set_dirty (cur->pagedir, page->user_addr, true);
+  lock_release (&cur->pd_lock);
+  unpin_frame_by_page (frame);
+
+  /* If the page was just a swap page then we can delete it since its only
+     purpose was to reference a frame with swap swap data. If it was file
+     data in swap, then mark it as a loaded file */
+  if (page->type == SWAP)
+    hash_delete (&cur->supp_pt, &page->pt_elem);
+  else if (page->type == (FILEINSWAP))
+    {
+      page->type = FILE;
+      page->is_loaded = true;
+    }
+  else if (page->type == ZEROINSWAP)
+    {
+      page->type = ZERO;
+      page->is_loaded = true;
+    }
+}
+
+/* Called after a swap fault on UPAGE. Reads in up to CUR->ra_window of the
+   following pages in the direction the faults are moving, stopping at the
+   first page that is not waiting in swap. The window doubles when most of
+   the pages read ahead last time have been used since, and halves when most
+   have not. */
+static void
+swap_read_ahead (struct thread *cur, uint8_t *upage)
+{
+  int hits = 0;
+  int total = 0;
+  int i;
+
+  /* Score the previous read-ahead: a page has been used if its accessed bit
+     has been set since we mapped it */
+  lock_acquire (&cur->pd_lock);
+  for (i = 0; i < READ_AHEAD_MAX && cur->ra_pages[i] != NULL; ++i)
+    {
+      if (pagedir_is_accessed (cur->pagedir, cur->ra_pages[i]))
+        hits++;
+      total++;
+      cur->ra_pages[i] = NULL;
+    }
+  lock_release (&cur->pd_lock);
+
+  read_ahead_hit_cnt += hits;
+  if (total > 0)
+    {
+      if (hits * 2 >= total && cur->ra_window < READ_AHEAD_MAX)
+        cur->ra_window *= 2;
+      else if (hits * 2 < total && cur->ra_window > 1)
+        cur->ra_window /= 2;
+    }
+
+  int step = upage >= (uint8_t *) cur->ra_last_fault ? PGSIZE : -PGSIZE;
+  cur->ra_last_fault = upage;
+
+  for (i = 0; i < cur->ra_window; ++i)
+    {
+      uint8_t *next = upage + (i + 1) * step;
+      if (next == NULL || !is_user_vaddr (next))
+        break;
+
+      struct sup_page *page = get_sup_page (&cur->supp_pt, next);
+      if (page == NULL || page->is_loaded || (page->type & SWAP) == 0
+          || pagedir_get_page (cur->pagedir, next) != NULL)
+        break;
+
+      swap_in (cur, page);
+      cur->ra_pages[i] = next;
+      read_ahead_cnt++;
+    }
+}
+
+/* Returns how many pages to read ahead after a fault on UPAGE, in an
+   executable or mapping whose previous faults stopped just before
+   NEXT_FAULT. Faults that carry on where the last one left off are
+   sequential and get the full window; others are treated as random. A
+   null NEXT_FAULT means this is the first fault, which is assumed to be
+   the start of a sequential run. */
+static size_t
+read_ahead_window (uint8_t *upage, void *next_fault)
+{
+  int window = file_read_ahead;
+
+  if (next_fault != NULL && upage != next_fault)
+    return 0;
+
+  if (window < 0)
+    window = 0;
+  if (window > FILE_READ_AHEAD_MAX)
+    window = FILE_READ_AHEAD_MAX;
+  return window;
+}
+
+/* Load PAGE of thread CUR from its file, together with the pages after it
+   that hold the next part of the same file, up to the read-ahead window.
+   All of them are read under a single hold of the file system lock. */
+static void
+load_file_pages (struct thread *cur, struct sup_page *page)
+{
+  struct sup_page *run[FILE_READ_AHEAD_MAX + 1];
+  uint8_t *frames[FILE_READ_AHEAD_MAX + 1];
+  uint8_t *upage = page->user_addr;
+  size_t window = read_ahead_window (upage, cur->exe_next_fault);
+  size_t cnt;
+  size_t i;
+
+  /* Gather the run of unloaded pages that follow on in the file. Pages
+     that are entirely zero are not worth a frame until they're touched */
+  run[0] = page;
+  for (cnt = 1; cnt <= window; ++cnt)
+    {
+      uint8_t *next = upage + cnt * PGSIZE;
+      struct sup_page *p = get_sup_page (&cur->supp_pt, next);
+
+      if (p == NULL || p->type != FILE || p->is_loaded || p->file != page->file
+          || p->offset != page->offset + (off_t) (cnt * PGSIZE)
+          || p->read_bytes == 0
+          || pagedir_get_page (cur->pagedir, next) != NULL)
+        break;
+      run[cnt] = p;
+    }
+  cur->exe_next_fault = upage + cnt * PGSIZE;
+  file_read_ahead_cnt += cnt - 1;
+
+  /* Read-only pages that another process running the same executable
+     already has resident are mapped straight away, and need no frame */
+  for (i = 0; i < cnt; ++i)
+    {
+      if (!run[i]->writable && share_map (run[i]))
+        {
+          frames[i] = NULL;
+          continue;
+        }
+      frames[i] = allocate_frame (PAL_USER);
+      pin_frame_by_page (frames[i]);
+    }
+
+  /* The file system takes no lock across the copy out of the buffer cache,
+     so this is safe even when the fault comes from inside a read system
+     call. Sectors that are not cached go straight into the frame. */
+  for (i = 0; i < cnt; ++i)
+    {
+      if (frames[i] == NULL)
+        continue;
+
+      off_t read = file_read_page (run[i]->file, frames[i],
+                                   run[i]->read_bytes, run[i]->offset);
+      memset (frames[i] + read, 0, PGSIZE - read);
+    }
+
+  /* Add the frames with their new data to the page directory of the
+     current thread */
+  for (i = 0; i < cnt; ++i)
+    {
+      if (frames[i] == NULL)
+        continue;
+
+      /* Read-only pages go into the page cache for other processes to
+         share, unless one of them beat us to it */
+      if (!run[i]->writable)
+        {
+          bool added = share_add (run[i], frames[i]);
+          unpin_frame_by_page (frames[i]);
+          if (!added)
+            free_frame (frames[i]);
+          continue;
+        }
+
+      unpin_frame_by_page (frames[i]);
+
+      lock_acquire (&cur->pd_lock);
+      if (!pagedir_set_page (cur->pagedir, run[i]->user_addr, frames[i],
+                             run[i]->writable))
+        free_frame (frames[i]);
+      lock_release (&cur->pd_lock);
+
+      run[i]->is_loaded = true;
+    }
+}
+
+/* Load UPAGE of mapping M, in the address space of thread CUR, and read
+   ahead the pages after it in the mapping that are not loaded yet. */
+static void
+load_mapped_pages (struct thread *cur, struct mapping *m, uint8_t *upage)
+{
+  uint8_t *frames[FILE_READ_AHEAD_MAX + 1];
+  uint8_t *end = (uint8_t *) m->addr + m->num_pages * PGSIZE;
+  size_t window = read_ahead_window (upage, m->next_fault);
+  size_t cnt;
+  size_t i;
+
+  /* Stop at the first page that is loaded, or that was evicted to swap
+     and so has newer data than the file. */
+  for (cnt = 1; cnt <= window; ++cnt)
+    {
+      uint8_t *next = upage + cnt * PGSIZE;
+      if (next >= end || pagedir_get_page (cur->pagedir, next) != NULL
+          || get_sup_page (&cur->supp_pt, next) != NULL)
+        break;
+    }
+  m->next_fault = upage + cnt * PGSIZE;
+  file_read_ahead_cnt += cnt - 1;
+
+  for (i = 0; i < cnt; ++i)
+    {
+      frames[i] = allocate_frame (PAL_USER);
+      pin_frame_by_page (frames[i]);
+    }
+
+  for (i = 0; i < cnt; ++i)
+    {
+      off_t offset = upage + i * PGSIZE - (uint8_t *) m->addr;
+      off_t read = file_read_page (m->file, frames[i], PGSIZE, offset);
+      memset (frames[i] + read, 0, PGSIZE - read);
+    }
+
+  for (i = 0; i < cnt; ++i)
+    {
+      unpin_frame_by_page (frames[i]);
+
+      lock_acquire (&cur->pd_lock);
+      if (!pagedir_set_page (cur->pagedir, upage + i * PGSIZE, frames[i],
+                             true))
+        free_frame (frames[i]);
+      lock_release (&cur->pd_lock);
+    }
+}
+
+/* Map a zero-filled page at UPAGE for thread CUR. A page that is only being
+   read gets the shared zero frame, read-only, and only gets a frame of its
+   own when it is first written; see copy_on_write(). WRITE says whether the
+   faulting access was a write to a writable page, in which case the frame
+   is allocated straight away. */
+static void
+map_zero_page (struct thread *cur, uint8_t *upage, bool write)
+{
+  void *frame = write ? allocate_frame (PAL_USER | PAL_ZERO)
+                      : get_zero_frame ();
+
+  lock_acquire (&cur->pd_lock);
+  if (!pagedir_set_page (cur->pagedir, upage, frame, write) && write)
+    free_frame (frame);
+  lock_release (&cur->pd_lock);
+
+  if (!write)
+    zero_map_cnt++;
+}
+
+/* If UPAGE of thread CUR is mapped to the zero frame and is meant to be
+   writable, replace the mapping with a writable frame of its own and
+   return true. Returns false for any other write to a read-only page. */
+static bool
+copy_on_write (struct thread *cur, uint8_t *upage)
+{
+  struct sup_page *page = get_sup_page (&cur->supp_pt, upage);
+  bool zero;
+  void *frame;
+
+  if (page != NULL && !page->writable)
+    return false;
+
+  lock_acquire (&cur->pd_lock);
+  zero = is_zero_frame (pagedir_get_page (cur->pagedir, upage));
+  lock_release (&cur->pd_lock);
+  if (!zero)
+    return false;
+
+  /* Allocating may evict, which takes page directory locks, so do it
+     before taking ours. The zero page itself is never evicted, so the
+     mapping cannot change under us */
+  frame = allocate_frame (PAL_USER | PAL_ZERO);
+  pin_frame_by_page (frame);
+
+  lock_acquire (&cur->pd_lock);
+  pagedir_clear_page (cur->pagedir, upage);
+  if (!pagedir_set_page (cur->pagedir, upage, frame, true))
+    {
+      unpin_frame_by_page (frame);
+      free_frame (frame);
+      lock_release (&cur->pd_lock);
+      return false;
+    }
+  lock_release (&cur->pd_lock);
+
+  unpin_frame_by_page (frame);
+  copy_on_write_cnt++;
+  return true;
+}
+
+/* Returns true if FAULT_ADDR, in thread CUR, is a stack access: at or above
+   (or only just below, as PUSHA can be) the stack pointer ESP, and within
+   CUR's stack limit. */
+static bool
+is_stack_access (struct thread *cur, void *fault_addr, void *esp)
+{
+  uint8_t *addr = fault_addr;
+
+  return (is_user_vaddr (addr)
+          && addr >= (uint8_t *) esp - 32
+          && (size_t) ((uint8_t *) PHYS_BASE - (uint8_t *) pg_round_down (addr))
+             <= cur->stack_limit);
+}
+
+/* Grow the stack of thread CUR down to UPAGE. The page is demand-zero:
+   WRITE says whether the faulting access was a write, as for
+   map_zero_page(). */
+static void
+grow_stack (struct thread *cur, uint8_t *upage, bool write)
+{
+  struct sup_page *page = create_sup_page (NULL, 0, PGSIZE, true, upage, 0);
+
+  page->type = ZERO;
+  add_sup_page (&cur->supp_pt, page);
+
+  map_zero_page (cur, upage, write);
+  page->is_loaded = true;
+}
@@ -5,7 +5,12 @@
 #define PF_P 0x1    /* 0: not-present page. 1: access rights violation. */
 #define PF_W 0x2    /* 0: read, 1: write. */
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
-#define MAXSIZE 0x800000 /* 8 MB max stack size. */
+
+/* Most pages read ahead on a fault on a file-backed page. */
+#define FILE_READ_AHEAD_MAX 16
+
+/* -fra: Pages to read ahead on sequential file-backed faults. */
+extern int file_read_ahead;
 
 void exception_init (void);
 void exception_print_stats (void);
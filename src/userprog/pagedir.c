@@ -7,6 +7,10 @@
 #include "threads/palloc.h"
 #include "vm/frame.h"
 
+/* PTE bit, available for OS use, that records that the page was accessed
+   before the last working-set sample cleared its accessed bit. */
+#define PTE_REF 0x00000200
+
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
 
@@ -41,7 +45,7 @@ pagedir_destroy (uint32_t *pd)
         uint32_t *pte;
 
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P)
+          if (*pte & PTE_P && !is_zero_frame (pte_get_page (*pte)))
             palloc_free_page (pte_get_page (*pte));
         palloc_free_page (pt);
       }
@@ -189,12 +193,13 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
-   PD contains no PTE for VPAGE. */
+   PD contains no PTE for VPAGE.  Accesses that
+   pagedir_sample_accessed() has already counted still count. */
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage)
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_A) != 0;
+  return pte != NULL && (*pte & (PTE_A | PTE_REF)) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
@@ -209,12 +214,43 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
         *pte |= PTE_A;
       else
         {
-          *pte &= ~(uint32_t) PTE_A;
+          *pte &= ~(uint32_t) (PTE_A | PTE_REF);
           invalidate_pagedir (pd);
         }
     }
 }
 
+/* Returns the number of user pages in PD that have been accessed
+   since the last call, which is the size of the process's
+   working set over that interval.  Their accessed bits are
+   cleared so that the next call only counts new accesses, but
+   the access is remembered in PTE_REF for pagedir_is_accessed(),
+   so that sampling does not hide pages from the clock hand. */
+size_t
+pagedir_sample_accessed (uint32_t *pd)
+{
+  uint32_t *pde;
+  size_t cnt = 0;
+
+  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P)
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+          if ((*pte & (PTE_P | PTE_A)) == (PTE_P | PTE_A))
+            {
+              *pte = (*pte & ~(uint32_t) PTE_A) | PTE_REF;
+              cnt++;
+            }
+      }
+
+  if (cnt > 0)
+    invalidate_pagedir (pd);
+  return cnt;
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -21,11 +21,15 @@
 #ifdef VM
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/share.h"
 #include "userprog/syscall.h"
 #endif
 #include <bitmap.h>
 #include "vm/mmap.h"
 
+/* Print memory statistics on exit? */
+bool process_vm_stats;
+
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 static unsigned sup_pt_hash_func (const struct hash_elem *elem, void *aux);
@@ -109,6 +113,18 @@ start_process (void *args_)
   hash_init (&thread_current ()->file_map, mapping_hash, mapping_less, NULL);
   thread_current()->next_mapid = 0;
 
+  /* Start off reading a little ahead on swap faults. */
+  thread_current ()->ra_window = 2;
+  thread_current ()->exe_next_fault = NULL;
+  thread_current ()->stack_limit = MAXSIZE;
+  frame_init_process (thread_current ());
+
+  /* Start in our parent's working directory. The parent is waiting
+     for us to load, so it cannot change directory meanwhile. */
+  if (thread_current ()->parent != NULL
+      && thread_current ()->parent->cwd != NULL)
+    thread_current ()->cwd = dir_reopen (thread_current ()->parent->cwd);
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
@@ -132,13 +148,6 @@ start_process (void *args_)
   if (!success)
     thread_exit ();
 
-  struct file *f = filesys_open (args[0]);
-  if (f != NULL)
-    {
-      current->executable = f;
-      file_deny_write (f);
-    }
-
   int i;
 
   /* Tokenise arguments */
@@ -309,6 +318,13 @@ process_exit (void)
   pd = cur->pagedir;
   if (pd != NULL)
     {
+      if (process_vm_stats)
+        frame_print_process_stats (cur);
+
+      /* Unmap the pages we share with other processes first, so that
+         pagedir_destroy() doesn't free their frames. */
+      share_release (cur);
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -318,8 +334,12 @@ process_exit (void)
          that's been freed (and cleared). */
       cur->pagedir = NULL;
       pagedir_activate (NULL);
-      pagedir_destroy (pd);
+
+      /* Drop our frame table entries before the pages go back to the
+         allocator, so that a freed page is never handed out again while the
+         frame table still thinks we own it. */
       reclaim_frames (cur);
+      pagedir_destroy (pd);
     }
 
   /* Destory the thread's suplementary page table */
@@ -346,6 +366,8 @@ process_exit (void)
       file_allow_write (cur->executable);
       file_close (cur->executable);
     }
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
 
   /* Signal the parent that the child is done. */
   struct thread *parent = cur->parent;
@@ -552,8 +574,16 @@ load (const char *file_name, void (**eip) (void), void **esp)
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  /* We arrive here whether the load is successful or not. The executable's
+     pages are read in from FILE as they fault, so it stays open until the
+     process exits. */
+  if (success)
+    {
+      t->executable = file;
+      file_deny_write (file);
+    }
+  else
+    file_close (file);
   return success;
 }
 
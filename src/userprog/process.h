@@ -13,4 +13,9 @@ void mapping_destroy (struct hash_elem *m_, void *aux UNUSED);
 
 #define MAXARGS 100
 
+/* If true, each process prints its resident set, page fault and
+   eviction counts when it exits.
+   Controlled by kernel command-line option "-vmstat". */
+extern bool process_vm_stats;
+
 #endif /* userprog/process.h */
@@ -8,8 +8,10 @@
 #include "userprog/process.h"
 #include "devices/shutdown.h"
 #include "devices/input.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
 #include <hash.h>
 #include "threads/malloc.h"
 #include "threads/palloc.h"
@@ -29,31 +31,29 @@ static bool create (const char *file, unsigned initial_size);
 static bool remove (const char *file);
 static int open (const char *file);
 static int filesize (int fd);
-static int read (int fd_ptr, void *buffer, unsigned length,
-                 void *stack_pointer);
+static int read (int fd_ptr, void *buffer, unsigned length);
 static int write (int fd, const void *buffer, unsigned size);
 static void seek (int fd, unsigned position);
 static unsigned tell (int fd);
 static void close (int fd);
+static bool chdir (const char *dir);
+static bool mkdir (const char *dir);
+static bool readdir (int fd, char *name);
+static bool isdir (int fd);
+static int inumber (int fd);
 static mapid_t mmap (int fd, void *addr);
 static void munmap (mapid_t mapping, bool del_and_free);
+static bool copy_in (void *dst, const void *usrc, size_t size);
+static bool copy_out (void *udst, const void *src, size_t size);
 
 static struct hash fd_hash;
 static int next_fd = 2;
 
-static struct lock filesys_lock;
+/* Protects fd_hash and next_fd. The file system does its own locking. */
+static struct lock fd_lock;
 
-void lock_filesystem (void)
-{
-  if (!lock_held_by_current_thread (&filesys_lock))
-    lock_acquire (&filesys_lock);
-}
-
-void release_filesystem (void)
-{
-  if (lock_held_by_current_thread (&filesys_lock))
-    lock_release (&filesys_lock);
-}
+/* Size of the kernel buffer a file name is copied into. */
+#define NAME_BUF_SIZE 256
 
 struct fd_node
   {
@@ -61,6 +61,7 @@ struct fd_node
     unsigned fd;
     struct thread *thread;
     struct file *file;
+    struct dir *dir;                    /* Set if the file is a directory. */
   };
 
 struct fd
@@ -102,36 +103,39 @@ destructor_func (struct hash_elem *e_, void *aux UNUSED)
   free (e);
 }
 
-/* Returns a file * for a given int fd. Terminates the process with an error
-   code if the fd is not mapped, or is stdin/stdout. */
-static struct file *
-fd_to_file (int fd)
+/* Returns the fd_node for a given int fd. Terminates the process with an
+   error code if the fd is not mapped, or is stdin/stdout. */
+static struct fd_node *
+fd_to_node (int fd)
 {
   struct fd_node node;
   node.fd = fd;
 
+  lock_acquire (&fd_lock);
   struct hash_elem *e = hash_find (&fd_hash, &node.hash_elem);
+  struct fd_node *entry = (e != NULL
+                           ? hash_entry (e, struct fd_node, hash_elem)
+                           : NULL);
+  lock_release (&fd_lock);
 
   /* fd isn't mapped. Terminate.
      stdin/stdout failure cases are also caught here. */
-  if (e == NULL)
-    {
-      if (lock_held_by_current_thread (&filesys_lock))
-        release_filesystem ();
-      exit (-1);
-    }
-
-  struct fd_node *entry = hash_entry (e, struct fd_node, hash_elem);
+  if (entry == NULL)
+    exit (-1);
 
   /* fd doesn't belong to the current thread. Terminate. */
   if (entry->thread != thread_current ())
-    {
-      if (lock_held_by_current_thread (&filesys_lock))
-        release_filesystem ();
-      exit (-1);
-    }
+    exit (-1);
 
-  return entry->file;
+  return entry;
+}
+
+/* Returns a file * for a given int fd. Terminates the process with an error
+   code if the fd is not mapped, or is stdin/stdout. */
+static struct file *
+fd_to_file (int fd)
+{
+  return fd_to_node (fd)->file;
 }
 
 void
@@ -140,20 +144,22 @@ syscall_init (void)
   if (!hash_init (&fd_hash, hash_func, less_func, NULL))
     PANIC ("Failed to allocate memory for file descriptor map");
 
-  lock_init (&filesys_lock);
+  lock_init (&fd_lock);
 
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
 /* Checks that a pointer points to a valid user memory address, and is therefore
    safe to be dereferenced. If it's not safe, we terminate the process.
-   Returns true iff the ptr can safely be dereferenced. */
+   Returns true iff the ptr can safely be dereferenced.
+
+   The page need not be resident: the kernel reads and writes user memory in
+   place, and page_fault() loads the page, grows the stack, or terminates the
+   process if there is nothing mapped there at all. */
 static bool
 is_safe_user_ptr (const void *ptr)
 {
-  struct thread *t = thread_current();
-  if (ptr == NULL || !is_user_vaddr (ptr) ||
-      pagedir_get_page (t->pagedir, ptr) == NULL)
+  if (ptr == NULL || !is_user_vaddr (ptr))
     {
       /* Destroy thread. */
       exit (-1);
@@ -165,6 +171,98 @@ is_safe_user_ptr (const void *ptr)
     }
 }
 
+/* Copies the null-terminated string at user address US into the SIZE-byte
+   kernel buffer KS. Returns true if successful, false if it does not fit.
+   Terminates the process if the string is not in user memory.
+
+   File system calls work on the copy, so that they never fault on a bad
+   user address while holding a file system lock. */
+static bool
+copy_in_string (char *ks, const char *us, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    {
+      is_safe_user_ptr (us + i);
+      ks[i] = us[i];
+      if (ks[i] == '\0')
+        return true;
+    }
+  return false;
+}
+
+/* Reads a byte at user virtual address UADDR, which must be below
+   PHYS_BASE. Returns the byte value if successful, -1 if UADDR is not
+   mapped. Must be called with the running thread's user_copy set, so that
+   page_fault() resumes at label 1 instead of killing the process. */
+static inline int
+get_user (const uint8_t *uaddr)
+{
+  int result;
+  asm ("movl $1f, %0; movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST, which must be below PHYS_BASE.
+   Returns true if successful, false if UDST is not mapped writable.
+   Must be called with the running thread's user_copy set. */
+static inline bool
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  asm ("movl $1f, %0; movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address DST.
+   Returns true if successful, false if any of USRC is not user memory.
+   Unlike a plain memcpy(), a bad address does not kill the process on
+   the spot, so the caller can give up what it holds first. */
+static bool
+copy_in (void *dst_, const void *usrc_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+  struct thread *cur = thread_current ();
+  size_t i;
+
+  cur->user_copy = true;
+  for (i = 0; i < size; i++)
+    {
+      int byte;
+
+      if (!is_user_vaddr (usrc + i) || (byte = get_user (usrc + i)) == -1)
+        break;
+      dst[i] = byte;
+    }
+  cur->user_copy = false;
+
+  return i == size;
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address UDST.
+   Returns true if successful, false if any of UDST is not writable user
+   memory. */
+static bool
+copy_out (void *udst_, const void *src_, size_t size)
+{
+  uint8_t *udst = udst_;
+  const uint8_t *src = src_;
+  struct thread *cur = thread_current ();
+  size_t i;
+
+  cur->user_copy = true;
+  for (i = 0; i < size; i++)
+    if (!is_user_vaddr (udst + i) || !put_user (udst + i, src[i]))
+      break;
+  cur->user_copy = false;
+
+  return i == size;
+}
+
 /* Switch on the system call numbers defined in lib/syscall-nr.h, and call the
    appropriate system call. If the system call returns something, then put
    that value in f->eax. */
@@ -176,6 +274,10 @@ syscall_handler (struct intr_frame *f)
 
   uint32_t *stack_pointer = f->esp;
 
+  /* page_fault() needs the user stack pointer to tell whether a fault on a
+     user buffer in this system call should grow the stack. */
+  thread_current ()->user_esp = f->esp;
+
   if (is_safe_user_ptr (stack_pointer))
     {
       int syscall_number = *stack_pointer;
@@ -227,13 +329,11 @@ syscall_handler (struct intr_frame *f)
             if (is_safe_user_ptr (stack_pointer + 1) &&
                 is_safe_user_ptr (stack_pointer + 2) &&
                 is_safe_user_ptr (stack_pointer + 3))
-                  {
-                    f->eax = read (*(stack_pointer + 1),
-                                   (void *) *(stack_pointer + 2),
-                                   *(stack_pointer + 3),
-                                   stack_pointer);
-                    break;
-                  }
+              f->eax = read (*(stack_pointer + 1),
+                             (void *) *(stack_pointer + 2),
+                             *(stack_pointer + 3));
+            break;
+
           case SYS_WRITE:
             if (is_safe_user_ptr (stack_pointer + 1) &&
                 is_safe_user_ptr (stack_pointer + 2) &&
@@ -271,6 +371,33 @@ syscall_handler (struct intr_frame *f)
               munmap (*(stack_pointer + 1), true);
             break;
 
+          case SYS_CHDIR:
+            if (is_safe_user_ptr (stack_pointer + 1))
+              f->eax = chdir ((char *) *(stack_pointer + 1));
+            break;
+
+          case SYS_MKDIR:
+            if (is_safe_user_ptr (stack_pointer + 1))
+              f->eax = mkdir ((char *) *(stack_pointer + 1));
+            break;
+
+          case SYS_READDIR:
+            if (is_safe_user_ptr (stack_pointer + 1) &&
+                is_safe_user_ptr (stack_pointer + 2))
+              f->eax = readdir (*(stack_pointer + 1),
+                                (char *) *(stack_pointer + 2));
+            break;
+
+          case SYS_ISDIR:
+            if (is_safe_user_ptr (stack_pointer + 1))
+              f->eax = isdir (*(stack_pointer + 1));
+            break;
+
+          case SYS_INUMBER:
+            if (is_safe_user_ptr (stack_pointer + 1))
+              f->eax = inumber (*(stack_pointer + 1));
+            break;
+
           default:
             printf("%i\n", syscall_number);
             NOT_REACHED ();
@@ -384,13 +511,11 @@ wait (pid_t pid)
 static bool
 create (const char *file, unsigned initial_size)
 {
+  char name[NAME_BUF_SIZE];
+
   if (is_safe_user_ptr (file))
-    {
-      lock_filesystem ();
-      bool status = filesys_create (file, initial_size);
-      release_filesystem ();
-      return status;
-    }
+    return (copy_in_string (name, file, sizeof name)
+            && filesys_create (name, initial_size));
 
   NOT_REACHED ();
 }
@@ -399,13 +524,11 @@ create (const char *file, unsigned initial_size)
 static bool
 remove (const char *file)
 {
+  char name[NAME_BUF_SIZE];
+
   if (is_safe_user_ptr (file))
-    {
-      lock_filesystem ();
-      bool status = filesys_remove (file);
-      release_filesystem ();
-      return status;
-    }
+    return (copy_in_string (name, file, sizeof name)
+            && filesys_remove (name));
 
   NOT_REACHED ();
 }
@@ -415,26 +538,39 @@ remove (const char *file)
 static int
 open (const char *filename)
 {
+  char name[NAME_BUF_SIZE];
+
   if (is_safe_user_ptr (filename))
     {
-      lock_filesystem ();
+      if (!copy_in_string (name, filename, sizeof name))
+        return -1;
 
-      struct file *open_file = filesys_open (filename);
+      struct file *open_file = filesys_open (name);
       if (open_file == NULL)
-        {
-          release_filesystem ();
-          return -1;
-        }
+        return -1;
 
       /* Allocate an fd. */
       struct fd_node *node = malloc (sizeof (struct fd_node));
       if (node == NULL)
         PANIC ("Failed to allocate memory for file descriptor node");
 
-      node->fd = next_fd++;
       node->thread = thread_current ();
       node->file = open_file;
+      node->dir = NULL;
+      if (inode_is_dir (file_get_inode (open_file)))
+        {
+          node->dir = dir_open (inode_reopen (file_get_inode (open_file)));
+          if (node->dir == NULL)
+            {
+              file_close (open_file);
+              free (node);
+              return -1;
+            }
+        }
+      lock_acquire (&fd_lock);
+      node->fd = next_fd++;
       hash_insert (&fd_hash, &node->hash_elem);
+      lock_release (&fd_lock);
 
       struct fd *fd = malloc (sizeof (struct fd));
       if (fd == NULL)
@@ -443,7 +579,6 @@ open (const char *filename)
 
       list_push_back (&thread_current ()->open_fds, &fd->elem);
 
-      release_filesystem ();
       return node->fd;
     }
 
@@ -454,77 +589,67 @@ open (const char *filename)
 static int
 filesize (int fd)
 {
-  lock_filesystem ();
-  int length = file_length (fd_to_file (fd));
-  release_filesystem ();
-  return length;
+  return file_length (fd_to_file (fd));
 }
 
 /* Reads size bytes from the file open as fd into buffer. Returns the number
    of bytes actually read, or -1 if the file could not be read.
    fd == 0 reads from the keyboard using input_getc(). */
 static int
-read (int fd, void *buffer, unsigned length, void *stack_pointer)
+read (int fd, void *buffer, unsigned length)
 {
   if (fd == STDOUT_FILENO)
     {
       exit (-1);
     }
-  else if (is_user_vaddr (buffer))
+  else if (is_safe_user_ptr (buffer) && is_safe_user_ptr (buffer + length))
     {
-      void *rd_buffer = pg_round_down (buffer);
-
-      struct thread *cur = thread_current ();
-      struct sup_page *page = get_sup_page (&cur->supp_pt, rd_buffer);
-
-      /* Checking if we have to expand the stack. */
-      if (page == NULL && stack_pointer - 32 <= buffer)
-        {
-          /* Run out of stack space. */
-          if (PHYS_BASE - buffer > MAXSIZE)
-            exit (-1);
-
-          /* Check if we need to expand the stack for the first page that the
-             buffer starts of */
-          if (pagedir_get_page (cur->pagedir, rd_buffer) == NULL)
-            {
-              void *new_frame = allocate_frame (PAL_USER | PAL_ZERO);
-              pagedir_set_page (cur->pagedir, rd_buffer, new_frame, true);
-            }
-
-          /* Loop up the stack, checking if we need to grow the stack at that
-             point, until we reach PHYS_BASE or the current page is already
-             loaded */
-          unsigned counter;
-          for (counter = PGSIZE;
-               is_user_vaddr (rd_buffer + counter) &&
-               pagedir_get_page (cur->pagedir, rd_buffer + counter) == NULL;
-               counter += PGSIZE)
-            {
-              void *new_frame = allocate_frame (PAL_USER | PAL_ZERO);
-              pagedir_set_page (cur->pagedir, rd_buffer + counter,
-                                new_frame, true);
-            }
-        }
-
+      /* Pages of the buffer, including any the stack has to grow into, are
+         faulted in one at a time as the data is copied out */
       if (fd == STDIN_FILENO)
         {
           unsigned i = 0;
           uint8_t *b = buffer;
           for (; i < length; ++i)
-            b[i] = (char) input_getc ();
+            {
+              uint8_t c = input_getc ();
+              if (!copy_out (b + i, &c, 1))
+                exit (-1);
+            }
 
           return length;
         }
 
-      /* If the buffer is safe to write to, either it has been loaded
-         or can be loaded in a page fault. */
+      /* The file system reads into a kernel page, never into the user's
+         buffer: a bad address there would kill the process in the middle
+         of the buffer cache, with a cache block still pinned. */
       else
         {
-          lock_filesystem ();
-          int size = file_read (fd_to_file (fd), buffer, length);
-          release_filesystem ();
-          return size;
+          struct fd_node *node = fd_to_node (fd);
+          uint8_t *kbuf;
+          unsigned done;
+
+          if (node->dir != NULL)
+            return -1;
+          kbuf = palloc_get_page (0);
+          if (kbuf == NULL)
+            return -1;
+          for (done = 0; done < length; )
+            {
+              unsigned chunk = length - done < PGSIZE ? length - done : PGSIZE;
+              off_t n = file_read (node->file, kbuf, chunk);
+
+              if (!copy_out ((uint8_t *) buffer + done, kbuf, n))
+                {
+                  palloc_free_page (kbuf);
+                  exit (-1);
+                }
+              done += n;
+              if ((unsigned) n < chunk)
+                break;
+            }
+          palloc_free_page (kbuf);
+          return done;
         }
     }
   else
@@ -544,35 +669,48 @@ write (int fd, const void *buffer, unsigned size)
     exit (-1);
   else if (is_safe_user_ptr (buffer) && is_safe_user_ptr (buffer + size))
     {
-      if (fd == STDOUT_FILENO)
+      struct fd_node *node = NULL;
+      uint8_t *kbuf;
+      unsigned done;
+
+      if (fd != STDOUT_FILENO)
+        {
+          node = fd_to_node (fd);
+          if (node->dir != NULL)
+            return -1;
+        }
+
+      /* The data is copied into a kernel page first, so that neither the
+         console nor the file system faults on the user's buffer while
+         holding its locks. The console gets it MAX_PUTBUF bytes at a
+         time. */
+      kbuf = palloc_get_page (0);
+      if (kbuf == NULL)
+        return -1;
+      for (done = 0; done < size; )
         {
-          if (size < MAX_PUTBUF)
+          unsigned max = node == NULL ? MAX_PUTBUF : PGSIZE;
+          unsigned chunk = size - done < max ? size - done : max;
+          unsigned n;
+
+          if (!copy_in (kbuf, (const uint8_t *) buffer + done, chunk))
             {
-              putbuf (buffer, size);
-              return size;
+              palloc_free_page (kbuf);
+              exit (-1);
             }
-          else
+          if (node == NULL)
             {
-              int offset = 0;
-              while (size > MAX_PUTBUF)
-                {
-                  putbuf (buffer + offset, MAX_PUTBUF);
-                  offset += MAX_PUTBUF;
-                  size -= MAX_PUTBUF;
-                }
-
-              putbuf (buffer + offset, size);
-              offset += size;
-              return offset;
+              putbuf ((const char *) kbuf, chunk);
+              n = chunk;
             }
+          else
+            n = file_write (node->file, kbuf, chunk);
+          done += n;
+          if (n < chunk)
+            break;
         }
-      else
-        {
-          lock_filesystem ();
-          int length = file_write (fd_to_file (fd), buffer, size);
-          release_filesystem ();
-          return length;
-        }
+      palloc_free_page (kbuf);
+      return done;
     }
 
   NOT_REACHED ();
@@ -583,9 +721,7 @@ write (int fd, const void *buffer, unsigned size)
 static void
 seek (int fd, unsigned position)
 {
-  lock_filesystem ();
   file_seek (fd_to_file (fd), position);
-  release_filesystem ();
 }
 
 /* Returns the position of the next byte to be read or written in open file
@@ -593,10 +729,7 @@ seek (int fd, unsigned position)
 static unsigned
 tell (int fd)
 {
-  lock_filesystem ();
-  unsigned next = file_tell (fd_to_file (fd));
-  release_filesystem ();
-  return next;
+  return file_tell (fd_to_file (fd));
 }
 
 /* Closes file descriptor fd. Exiting or terminating a process implicitly
@@ -605,16 +738,17 @@ tell (int fd)
 static void
 close (int fd)
 {
-  lock_filesystem ();
-
   /* Close the file. */
-  file_close (fd_to_file (fd));
+  struct fd_node *n = fd_to_node (fd);
+  dir_close (n->dir);
+  file_close (n->file);
 
   /* Remove the fd from the map so it can't be closed twice. */
   struct fd_node node;
   node.fd = fd;
-  hash_find (&fd_hash, &node.hash_elem);
+  lock_acquire (&fd_lock);
   struct hash_elem *e = hash_delete (&fd_hash, &node.hash_elem);
+  lock_release (&fd_lock);
   destructor_func (e, NULL);
 
   /* Remove from thread's open_fds for the same reason. */
@@ -635,7 +769,72 @@ close (int fd)
 
   list_remove (el);
   free (f);
-  release_filesystem ();
+}
+
+/* Changes the current working directory of the process to dir, which may be
+   relative or absolute. Returns true iff successful. */
+static bool
+chdir (const char *dir)
+{
+  char name[NAME_BUF_SIZE];
+
+  if (is_safe_user_ptr (dir))
+    return (copy_in_string (name, dir, sizeof name)
+            && filesys_chdir (name));
+
+  NOT_REACHED ();
+}
+
+/* Creates the directory named dir, which may be relative or absolute.
+   Returns true iff successful. */
+static bool
+mkdir (const char *dir)
+{
+  char name[NAME_BUF_SIZE];
+
+  if (is_safe_user_ptr (dir))
+    return (copy_in_string (name, dir, sizeof name)
+            && filesys_mkdir (name));
+
+  NOT_REACHED ();
+}
+
+/* Reads a directory entry from the directory open as fd into name, which
+   must have room for READDIR_MAX_LEN + 1 bytes. Returns true iff an entry
+   was read; "." and ".." are never returned. */
+static bool
+readdir (int fd, char *name)
+{
+  char entry[NAME_MAX + 1];
+  struct fd_node *node = fd_to_node (fd);
+
+  if (node->dir == NULL || !dir_readdir (node->dir, entry))
+    return false;
+
+  /* Copy the name out only after the directory lock is dropped. */
+  if (is_safe_user_ptr (name) && is_safe_user_ptr (name + NAME_MAX))
+    {
+      if (!copy_out (name, entry, strlen (entry) + 1))
+        exit (-1);
+      return true;
+    }
+
+  NOT_REACHED ();
+}
+
+/* Returns true iff fd represents a directory. */
+static bool
+isdir (int fd)
+{
+  return fd_to_node (fd)->dir != NULL;
+}
+
+/* Returns the inode number of the file or directory open as fd, which
+   identifies it uniquely while it exists. */
+static int
+inumber (int fd)
+{
+  return inode_get_inumber (file_get_inode (fd_to_file (fd)));
 }
 
 /* Returns true iff a given address is mapped to a file in the current
@@ -674,11 +873,13 @@ mmap (int fd, void *addr)
       !is_user_vaddr (addr) || pg_ofs (addr) != 0)
     return -1;
 
-  struct file *file = fd_to_file (fd);
+  struct fd_node *node = fd_to_node (fd);
+  if (node->dir != NULL)
+    return -1;
+
+  struct file *file = node->file;
 
-  lock_filesystem ();
   int length = file_length (file);
-  release_filesystem ();
 
   if (length == 0)
       return -1;
@@ -704,12 +905,11 @@ mmap (int fd, void *addr)
 
   m->mapid = thread_current ()->next_mapid++;
 
-  lock_filesystem ();
   m->file = file_reopen (file);
-  release_filesystem ();
 
   m->addr = addr;
   m->num_pages = num_pages;
+  m->next_fault = NULL;
   hash_insert (&thread_current ()->file_map, &m->elem);
 
   return m->mapid;
@@ -743,24 +943,33 @@ munmap (mapid_t mapping, bool del_and_free)
     {
       struct file *f = m->file;
 
-      /* Write any dirty pages back to the file. */
+      /* Write any dirty pages back to the file, through a kernel page so
+         that the file system never touches user memory. This also runs
+         as the process exits, so a page that cannot be read is skipped
+         rather than killing the process again. Only the part of each
+         page that lies within the file is written, since files now grow
+         on write and unmapping must not change the file's length. */
+      uint8_t *kbuf = palloc_get_page (PAL_ASSERT);
+      off_t length = file_length (f);
       int i;
       for (i = 0; i < m->num_pages; ++i)
-        if (pagedir_is_dirty (thread_current ()->pagedir,
-                              m->addr + (PGSIZE * i)))
-          {
-            lock_filesystem ();
-            file_write_at (f, m->addr + (PGSIZE * i), PGSIZE, PGSIZE * i);
-            release_filesystem ();
-          }
+        {
+          off_t ofs = PGSIZE * i;
+          off_t size = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+          if (size > 0
+              && pagedir_is_dirty (thread_current ()->pagedir,
+                                   m->addr + ofs)
+              && copy_in (kbuf, m->addr + ofs, size))
+            file_write_at (f, kbuf, size, ofs);
+        }
+      palloc_free_page (kbuf);
 
       if (del_and_free)
         {
           hash_delete (&thread_current()->file_map, e);
 
-          lock_filesystem ();
           file_close (f);
-          release_filesystem ();
 
           free (m);
         }
@@ -9,8 +9,6 @@ typedef int pid_t;
 void syscall_init (void);
 void syscall_done (void);
 void exit (int status);
-void lock_filesystem (void);
-void release_filesystem (void);
 bool is_mapped (void *addr);
 struct mapping * addr_to_map (void *addr);
 
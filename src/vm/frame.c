@@ -6,68 +6,138 @@
 #include "vm/swap.h"
 #include "userprog/pagedir.h"
 #include "vm/page.h"
+#include "vm/share.h"
 #include <string.h>
 #include "threads/vaddr.h"
 #include "threads/pte.h"
 #include <bitmap.h>
+#include <stdio.h>
+#include "devices/timer.h"
+
+/* Page-fault-frequency frame quotas. Each process's quota is revised at a
+   page fault at most once every WS_INTERVAL timer ticks. A process that
+   faulted at least PFF_HIGH times per tick over the interval is short of
+   frames and has its quota raised by half; one that faulted less than once
+   every PFF_LOW ticks has its quota cut back towards its working set, the
+   number of pages it actually used over the interval. */
+#define WS_INTERVAL 10
+#define PFF_HIGH 2
+#define PFF_LOW 4
+#define QUOTA_MIN 32
 
 struct frame
   {
-    struct list_elem elem; /* Hash table element. */
+    struct list_elem elem; /* Element in the clock ring. */
     void *page;            /* Page occupying this frame. */
     struct thread* thread; /* Owner of this frame. */
     uint8_t *user_addr;    /* Stored to associate frames and sup_pt entries */
     uint32_t *pte;         /* Page table entry */
+    struct shared_page *share; /* Page cache entry if the frame is shared,
+                                  in which case the three members above are
+                                  not used. */
     bool pinned;           /* Is the frame pinned? */
+    bool in_use;           /* Has the frame been handed out? */
   };
 
-static struct list frame_table;
+/* The frame table has one entry for every page in the user pool, indexed by
+   the page's offset from the start of the pool, so looking up the frame for
+   a kernel page never has to search. */
+static struct frame *frame_table;
+static size_t frame_cnt;
+static uint8_t *user_pool_base;
+
+/* A page of zeros, mapped read-only wherever a process has a zero-filled
+   page it has not written to yet. It comes from the kernel pool, so it has
+   no frame table entry and is never evicted. */
+static void *zero_frame;
+
+/* Frames that are in use, in the order the clock hand visits them. The
+   hand persists between evictions. */
+static struct list frame_ring;
+static size_t ring_cnt;
+static struct list_elem *clock_hand;
+
+/* Eviction statistics. */
+static struct
+  {
+    long long evictions;        /* # of frames evicted. */
+    long long swept;            /* # of frames the clock hand passed. */
+    long long second_chances;   /* # of accessed bits cleared by the hand. */
+  }
+stats;
 
 static struct lock frame_lock;
 static struct lock eviction_lock;
 
-static struct frame *select_frame_to_evict (void);
+static size_t select_frames_to_evict (struct frame **victims, size_t max);
 static void *evict_frame (void);
 static void pin_frame (struct frame *);
 static void unpin_frame (struct frame *);
+static struct frame *frame_at (void *page);
+static struct frame *clock_advance (void);
+static void ring_insert (struct frame *);
+static void ring_remove (struct frame *);
 static struct frame *get_frame (void* page);
+static bool is_protected (struct frame *, struct thread *cur);
+static void charge (struct thread *, struct frame *);
+static void uncharge (struct thread *, struct frame *);
 
 void
 frame_init (void)
 {
-  list_init (&frame_table);
+  size_t i;
+
+  user_pool_base = palloc_user_base ();
+  frame_cnt = palloc_user_page_cnt ();
+
+  frame_table = calloc (frame_cnt, sizeof *frame_table);
+  if (frame_table == NULL && frame_cnt > 0)
+    PANIC ("Failed to allocate memory for frame table.");
+
+  for (i = 0; i < frame_cnt; ++i)
+    frame_table[i].page = user_pool_base + i * PGSIZE;
+
+  zero_frame = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+
+  list_init (&frame_ring);
   lock_init (&frame_lock);
   lock_init (&eviction_lock);
 }
 
-/* Get a frame by calling palloc_get_page and allocating a struct frame. If
-   no frame is available, evict a frame and use that */
+/* Get a frame by calling palloc_get_page and claiming its entry in the frame
+   table. If no frame is available, evict a frame and use that */
 void *
 allocate_frame (enum palloc_flags flags)
 {
+  ASSERT (flags & PAL_USER);
+
   lock_acquire (&frame_lock);
   void *page = palloc_get_page (flags);
-  lock_release (&frame_lock);
-  struct frame *f;
 
   if (page != NULL)
     {
-      f = malloc (sizeof (struct frame));
-      if (f == NULL)
-        PANIC ("Failed to allocate memory for frame.");
+      struct frame *f = frame_at (page);
+      ASSERT (f != NULL && !f->in_use);
 
       f->thread = thread_current ();
-      f->page = page;
+      f->user_addr = NULL;
+      f->pte = NULL;
+      f->share = NULL;
       f->pinned = false;
 
-      lock_acquire (&frame_lock);
-      list_push_back (&frame_table, &f->elem);
-      lock_release (&frame_lock);
+      ring_insert (f);
+      charge (f->thread, f);
     }
-  else
+  lock_release (&frame_lock);
+
+  if (page == NULL)
     {
       page = evict_frame ();
       ASSERT (page != NULL);
+
+      /* An evicted frame still holds its old contents */
+      if (flags & PAL_ZERO)
+        memset (page, 0, PGSIZE);
     }
 
   return page;
@@ -80,167 +150,435 @@ set_user_address (void *page, uint32_t *pte, void *upage)
 {
   struct frame *f = get_frame (page);
 
-  if (f != NULL)
+  if (f != NULL && f->share == NULL)
     {
       f->pte = pte;
       f->user_addr = upage;
     }
 }
 
-/* Choose a frame to evict and clear it from the page directory of its owner
-   thread */
+/* Mark the frame with page PAGE as holding shared page SP, which may be
+   mapped into any number of page directories. Shared frames do not count
+   against anyone's quota. */
+void
+frame_set_share (void *page, struct shared_page *sp)
+{
+  struct frame *f = get_frame (page);
+
+  ASSERT (f != NULL);
+  lock_acquire (&frame_lock);
+  uncharge (f->thread, f);
+  f->share = sp;
+  lock_release (&frame_lock);
+}
+
+/* Evict up to SWAP_CLUSTER frames in one pass and clear them from the page
+   directories of their owner threads. The victims that have to go to swap
+   are written out together, to adjacent swap slots where possible. The
+   first victim is handed to the current thread; the rest are given back to
+   the page allocator so that the next few allocations need not evict */
 void *
 evict_frame (void)
 {
-  struct frame *choice;
+  struct frame *victims[SWAP_CLUSTER];
+  struct sup_page *pages[SWAP_CLUSTER];
+  void *swap_pages[SWAP_CLUSTER];
+  size_t swap_slots[SWAP_CLUSTER];
+  size_t victim_cnt, swap_cnt;
+  size_t i;
   struct thread *cur = thread_current ();
 
   lock_acquire (&eviction_lock);
 
-  /* Pick a suitable candidate frame */
-  choice = select_frame_to_evict ();
+  /* Pick suitable candidate frames */
+  victim_cnt = select_frames_to_evict (victims, SWAP_CLUSTER);
 
   lock_release (&eviction_lock);
 
-  if (choice == NULL)
+  if (victim_cnt == 0)
     PANIC ("No frames could be evicted.");
 
-  struct thread *t = choice->thread;
-  struct sup_page *page = get_sup_page (&t->supp_pt, choice->user_addr);
-
-  if (page == NULL)
+  /* Find the sup_page of every victim, and gather up the ones whose data
+     has to be swapped out because the frame is dirty or the data cannot be
+     reloaded from a file */
+  swap_cnt = 0;
+  for (i = 0; i < victim_cnt; ++i)
     {
-      /* The sup_page may longer exist if the data was loaded from swap */
-      page = malloc (sizeof (struct sup_page));
-      page->user_addr = choice->user_addr;
-      page->type = SWAP;
-      add_sup_page (&t->supp_pt, page);
+      struct frame *choice = victims[i];
+      struct thread *t = choice->thread;
+
+      /* Shared frames are read-only executable pages that can always be
+         read back in, so they never go to swap */
+      if (choice->share != NULL)
+        {
+          pages[i] = NULL;
+          continue;
+        }
+
+      struct sup_page *page = get_sup_page (&t->supp_pt, choice->user_addr);
+
+      if (page == NULL)
+        {
+          /* The sup_page may longer exist if the data was loaded from swap */
+          page = malloc (sizeof (struct sup_page));
+          page->user_addr = choice->user_addr;
+          page->type = SWAP;
+          add_sup_page (&t->supp_pt, page);
+        }
+      pages[i] = page;
+
+      /* Write out through the kernel's mapping of the frame: the page is
+         not mapped in the current thread's address space */
+      if (pagedir_is_dirty (t->pagedir, page->user_addr)
+          || (page->type != FILE))
+        swap_pages[swap_cnt++] = choice->page;
     }
 
-  size_t swap_index = 0;
-  /* Swap the data out if the frame is dirty or if the data cannot be reloaded
-     from a file */
-  if (pagedir_is_dirty (t->pagedir, page->user_addr) || (page->type != FILE))
+  if (!pick_slots_and_swap (swap_pages, swap_cnt, swap_slots))
+    PANIC ("Could not swap out frame");
+
+  swap_cnt = 0;
+  for (i = 0; i < victim_cnt; ++i)
     {
-      pin_frame (choice);
-      swap_index = pick_slot_and_swap (page->user_addr);
-      unpin_frame (choice);
+      struct frame *choice = victims[i];
+      struct thread *t = choice->thread;
+      struct sup_page *page = pages[i];
 
-      if (swap_index == BITMAP_ERROR)
-        PANIC ("Could not swap out frame");
+      if (choice->share != NULL)
+        {
+          /* Unmap it from every process sharing it */
+          share_evict (choice->share);
+          lock_acquire (&frame_lock);
+          choice->share = NULL;
+          choice->thread = cur;
+          charge (cur, choice);
+          lock_release (&frame_lock);
+          unpin_frame (choice);
+          continue;
+        }
 
-      page->type = page->type | SWAP;
-    }
+      size_t swap_index = 0;
+      if (swap_cnt < SWAP_CLUSTER && swap_pages[swap_cnt] == choice->page)
+        {
+          swap_index = swap_slots[swap_cnt++];
+          page->type = page->type | SWAP;
+        }
 
-  /* Set the page as writeable if the corresponding page table entry is
-     writeable */
-  page->swap_index = swap_index;
-  page->swap_writable = *(choice->pte) & PTE_W;
+      /* Set the page as writeable if the corresponding page table entry is
+         writeable */
+      page->swap_index = swap_index;
+      page->swap_writable = *(choice->pte) & PTE_W;
 
-  choice->thread = cur;
-  choice->pte = NULL;
-  choice->user_addr = NULL;
+      lock_acquire (&frame_lock);
+      uncharge (t, choice);
+      t->evict_cnt++;
+      choice->thread = cur;
+      charge (cur, choice);
+      lock_release (&frame_lock);
+      choice->pte = NULL;
+      choice->user_addr = NULL;
 
-  /* Clear the frame from the former owner's page directory */
-  lock_acquire (&t->pd_lock);
-  pagedir_clear_page (t->pagedir, page->user_addr);
-  lock_release (&t->pd_lock);
+      /* Clear the frame from the former owner's page directory */
+      lock_acquire (&t->pd_lock);
+      pagedir_clear_page (t->pagedir, page->user_addr);
+      lock_release (&t->pd_lock);
 
-  page->is_loaded = false;
+      page->is_loaded = false;
+
+      /* select_frames_to_evict pinned the frame so that nobody else would
+         take it while we were writing it out */
+      unpin_frame (choice);
+    }
 
-  return choice->page;
+  /* Keep the first frame, and free the rest for whoever allocates next */
+  for (i = 1; i < victim_cnt; ++i)
+    free_frame (victims[i]->page);
+
+  return victims[0]->page;
 }
 
-static struct frame *
-select_frame_to_evict (void)
+/* Clock algorithm. The hand sweeps round the frame ring, carrying on from
+   wherever the previous eviction left it. Frames that have been accessed
+   since the hand last passed get their accessed bit cleared and a second
+   chance; frames that have not been accessed are chosen and pinned so no
+   other evictor can take them. Stores up to MAX victims in VICTIMS and
+   returns how many it found.
+
+   Frames of processes that are within their quota are protected from
+   other processes for the first revolution, so that a process that is
+   over its own quota mostly replaces its own pages. */
+static size_t
+select_frames_to_evict (struct frame **victims, size_t max)
 {
-  struct frame *choice = NULL;
-  struct list_elem *e;
+  struct thread *cur = thread_current ();
+  size_t ring_size;
+  size_t found = 0;
+  size_t i;
 
-  /* Second chance page replacement algorithm. We always ignore pinned
-     frames */
-  int j = 0;
-  for (; j < 2; ++j)
+  lock_acquire (&frame_lock);
+  ring_size = ring_cnt;
+  lock_release (&frame_lock);
+
+  /* Two revolutions are enough: the first clears every accessed bit, so the
+     second must find a victim unless everything is pinned. Once we have a
+     victim, stop gathering more at the end of the first revolution. */
+  for (i = 0; i < 2 * ring_size && found < max; ++i)
     {
-      /* The first loop finds any perfect candidates for eviction - one that
-         is neither accessed nor dirty. */
-      for (e = list_begin (&frame_table); e != list_end (&frame_table);
-           e = list_next (e))
-        {
-          choice = list_entry (e, struct frame, elem);
-          if (choice->pinned)
-            continue;
+      if (found > 0 && i >= ring_size)
+        break;
 
-          struct thread* owner = choice->thread;
-          lock_acquire (&owner->pd_lock);
+      lock_acquire (&frame_lock);
+      struct frame *choice = clock_advance ();
+      lock_release (&frame_lock);
 
-          if (!pagedir_is_dirty (owner->pagedir, choice->user_addr) &&
-              !pagedir_is_accessed (owner->pagedir, choice->user_addr))
-            {
-              /* A perfect frame to evict */
-              lock_release (&owner->pd_lock);
-              return choice;
-            }
+      if (choice == NULL)
+        break;
 
-          lock_release (&owner->pd_lock);
-        }
+      stats.swept++;
 
-      /* The second loop looks for slightly worse candidates - ones that are
-         not accessed but dirty. If they do not match this criteria, they are
-         given a second chance - their accessed bit is set, and we execute the
-         for loop again. */
-      for (e = list_begin (&frame_table); e != list_end (&frame_table);
-           e = list_next (e))
-        {
-          choice = list_entry (e, struct frame, elem);
-          if (choice->pinned)
-            continue;
-
-          struct thread* owner = choice->thread;
-          lock_acquire (&owner->pd_lock);
-          if (pagedir_is_dirty (owner->pagedir, choice->user_addr) &&
-              !pagedir_is_accessed (owner->pagedir, choice->user_addr))
-            {
-              lock_release (&owner->pd_lock);
+      if (choice->pinned)
+        continue;
 
-              lock_acquire (&frame_lock);
-              list_remove (e);
-              list_push_back (&frame_table, e);
-              lock_release (&frame_lock);
+      if (i < ring_size && is_protected (choice, cur))
+        continue;
 
-              return choice;
+      /* A shared frame gets a second chance if any of its sharers has used
+         it */
+      if (choice->share != NULL)
+        {
+          if (share_test_and_clear_accessed (choice->share))
+            {
+              stats.second_chances++;
+              continue;
             }
+          pin_frame (choice);
+          stats.evictions++;
+          victims[found++] = choice;
+          continue;
+        }
 
-          /* Frames that reach here will be hit earlier the next time round,
-             in the first while loop or the second depending on whether they
-             are dirty or not */
+      /* Frames which have not been installed in a page directory yet are
+         about to be used and count as pinned */
+      if (choice->pte == NULL)
+        continue;
+
+      struct thread* owner = choice->thread;
+      lock_acquire (&owner->pd_lock);
+      if (pagedir_is_accessed (owner->pagedir, choice->user_addr))
+        {
           pagedir_set_accessed (owner->pagedir, choice->user_addr, false);
           lock_release (&owner->pd_lock);
+          stats.second_chances++;
+          continue;
         }
+      lock_release (&owner->pd_lock);
+
+      pin_frame (choice);
+      stats.evictions++;
+      victims[found++] = choice;
     }
 
-  /* This will only get hit if every frame in existence is pinned */
-  return NULL;
+  /* This will only return 0 if every frame in existence is pinned */
+  return found;
 }
 
-/* Remove a frame struct from the frame table and free it */
+/* Return the frame under the clock hand and move the hand on to the next
+   frame in the ring, wrapping round at the end. Returns a null pointer if
+   the ring is empty. The frame lock must be held. */
+static struct frame *
+clock_advance (void)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (clock_hand == NULL)
+    return NULL;
+
+  struct frame *f = list_entry (clock_hand, struct frame, elem);
+  clock_hand = list_next (clock_hand);
+  if (clock_hand == list_end (&frame_ring))
+    clock_hand = list_begin (&frame_ring);
+
+  return f;
+}
+
+/* Add F to the ring just behind the clock hand, so that it is the last frame
+   the hand reaches. The frame lock must be held. */
+static void
+ring_insert (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (clock_hand == NULL)
+    {
+      list_push_back (&frame_ring, &f->elem);
+      clock_hand = &f->elem;
+    }
+  else
+    list_insert (clock_hand, &f->elem);
+
+  f->in_use = true;
+  ring_cnt++;
+}
+
+/* Take F out of the ring, moving the clock hand off it first if need be.
+   The frame lock must be held. */
+static void
+ring_remove (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (f->in_use);
+
+  if (clock_hand == &f->elem)
+    {
+      clock_advance ();
+      if (clock_hand == &f->elem)
+        clock_hand = NULL;
+    }
+
+  list_remove (&f->elem);
+  f->in_use = false;
+  ring_cnt--;
+}
+
+/* Returns true if the clock hand should pass over frame F, on behalf of
+   CUR, while protecting working sets: F belongs to another process that
+   is within its quota, or CUR is over its own quota and F is not CUR's.
+   Reading the counts without the frame lock is only a hint, which is all
+   a soft quota needs. */
+static bool
+is_protected (struct frame *f, struct thread *cur)
+{
+  struct thread *owner = f->thread;
+
+  if (f->share != NULL || owner == cur)
+    return false;
+  if (cur->resident >= cur->frame_quota)
+    return true;
+  return owner->resident <= owner->frame_quota;
+}
+
+/* Count frame F against thread T's resident set. The frame lock must be
+   held. */
+static void
+charge (struct thread *t, struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (f->share != NULL)
+    return;
+  if (++t->resident > t->resident_peak)
+    t->resident_peak = t->resident;
+}
+
+/* Stop counting frame F against thread T's resident set. The frame lock
+   must be held. */
+static void
+uncharge (struct thread *t, struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (f->share == NULL)
+    t->resident--;
+}
+
+/* Set up the working-set state of new process T. */
 void
-free_frame (void *page)
+frame_init_process (struct thread *t)
 {
-  struct frame *f;
-  struct list_elem *e;
+  t->resident = 0;
+  t->resident_peak = 0;
+  t->frame_quota = QUOTA_MIN;
+  t->working_set = 0;
+  t->fault_cnt = 0;
+  t->evict_cnt = 0;
+  t->sample_tick = timer_ticks ();
+  t->sample_fault_cnt = 0;
+}
+
+/* Record a page fault by the current process T, and once per WS_INTERVAL
+   sample its working set and revise its frame quota from its page fault
+   frequency. */
+void
+frame_note_fault (struct thread *t)
+{
+  int64_t now = timer_ticks ();
+  int64_t elapsed = now - t->sample_tick;
+  long long faults;
+
+  ASSERT (t == thread_current ());
+
+  t->fault_cnt++;
+  if (elapsed < WS_INTERVAL)
+    return;
+
+  faults = t->fault_cnt - t->sample_fault_cnt;
+  t->sample_tick = now;
+  t->sample_fault_cnt = t->fault_cnt;
+
+  lock_acquire (&t->pd_lock);
+  t->working_set = pagedir_sample_accessed (t->pagedir);
+  lock_release (&t->pd_lock);
+
+  if (faults >= PFF_HIGH * elapsed)
+    {
+      /* Faulting heavily: let it have more frames */
+      size_t quota = t->frame_quota > t->resident ? t->frame_quota
+                                                  : t->resident;
+      t->frame_quota = quota + quota / 2;
+    }
+  else if (faults * PFF_LOW < elapsed)
+    {
+      /* Hardly faulting: it only needs its working set */
+      t->frame_quota = t->working_set + t->working_set / 4;
+    }
+
+  if (t->frame_quota < QUOTA_MIN)
+    t->frame_quota = QUOTA_MIN;
+  if (t->frame_quota > frame_cnt)
+    t->frame_quota = frame_cnt;
+}
+
+/* Prints the memory statistics of process T. */
+void
+frame_print_process_stats (struct thread *t)
+{
+  printf ("%s: %zu resident (peak %zu), %lld faults, %lld evictions\n",
+          t->name, t->resident, t->resident_peak, t->fault_cnt,
+          t->evict_cnt);
+}
+
+/* Prints eviction statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frame: %lld evictions, %lld frames swept, %lld second chances\n",
+          stats.evictions, stats.swept, stats.second_chances);
+}
+
+/* Returns the shared zero frame. */
+void *
+get_zero_frame (void)
+{
+  return zero_frame;
+}
+
+/* Returns true if PAGE is the shared zero frame. */
+bool
+is_zero_frame (const void *page)
+{
+  return page != NULL && page == zero_frame;
+}
 
+/* Release a frame's entry in the frame table and free its page */
+void
+free_frame (void *page)
+{
   lock_acquire (&frame_lock);
-  for (e = list_begin (&frame_table); e != list_end (&frame_table);
-       e = list_next (e))
+  struct frame *f = frame_at (page);
+  if (f != NULL && f->in_use)
     {
-      f = list_entry (e, struct frame, elem);
-      if (f->page == page)
-        {
-          list_remove (e);
-          free (f);
-          break;
-        }
+      uncharge (f->thread, f);
+      ring_remove (f);
     }
   lock_release (&frame_lock);
 
@@ -273,28 +611,34 @@ unpin_frame_by_page (void* kpage)
   f->pinned = false;
 }
 
-/* Get a frame from its page address */
-static struct frame*
-get_frame (void* page)
+/* Get a frame from its page address, or a null pointer if the page is not
+   an allocated frame */
+static struct frame *
+get_frame (void *page)
 {
-  struct frame *f;
-  struct list_elem *e;
-
   lock_acquire (&frame_lock);
-  for (e = list_begin (&frame_table); e != list_end (&frame_table);
-       e = list_next (e))
-    {
-      f = list_entry (e, struct frame, elem);
-      if (f->page == page)
-        break;
-
-      f = NULL;
-    }
+  struct frame *f = frame_at (page);
+  if (f != NULL && !f->in_use)
+    f = NULL;
   lock_release (&frame_lock);
 
   return f;
 }
 
+/* Get the frame table entry for PAGE, whether or not it is in use. Returns
+   a null pointer if PAGE is not in the user pool */
+static struct frame *
+frame_at (void *page)
+{
+  uint8_t *p = page;
+
+  if (p < user_pool_base)
+    return NULL;
+
+  size_t index = (p - user_pool_base) / PGSIZE;
+  return index < frame_cnt ? &frame_table[index] : NULL;
+}
+
 /* Remove any frames from the frame table that are owned by the given thread.
    Called by process_exit() */
 void
@@ -305,7 +649,7 @@ reclaim_frames (struct thread *t)
   struct list_elem *next = NULL;
 
   lock_acquire (&frame_lock);
-  for (e = list_begin (&frame_table); e != list_end (&frame_table);
+  for (e = list_begin (&frame_ring); e != list_end (&frame_ring);
        e = next)
     {
       next = list_next (e);
@@ -313,10 +657,11 @@ reclaim_frames (struct thread *t)
       f = list_entry (e, struct frame, elem);
       ASSERT (f != NULL);
 
-      if (f->thread == t)
+      /* Shared frames are not freed with T's page directory */
+      if (f->thread == t && f->share == NULL)
         {
-          list_remove (e);
-          free (f);
+          uncharge (t, f);
+          ring_remove (f);
         }
     }
   lock_release (&frame_lock);
@@ -4,12 +4,21 @@
 #include "threads/thread.h"
 #include "threads/palloc.h"
 
+struct shared_page;
+
 void frame_init (void);
 void *allocate_frame (enum palloc_flags flags);
 void free_frame (void *);
 void set_user_address (void*, uint32_t *, void *);
+void frame_set_share (void *, struct shared_page *);
 void pin_frame_by_page (void* kpage);
 void unpin_frame_by_page (void* kpage);
 void reclaim_frames (struct thread *t);
+void frame_print_stats (void);
+void frame_init_process (struct thread *t);
+void frame_note_fault (struct thread *t);
+void frame_print_process_stats (struct thread *t);
+void *get_zero_frame (void);
+bool is_zero_frame (const void *);
 
 #endif /* vm/frame.h */
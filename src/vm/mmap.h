@@ -13,6 +13,8 @@ struct mapping
     struct file *file;
     void *addr;
     int num_pages;
+    void *next_fault;       /* Page just after the last one faulted in, for
+                               spotting sequential access. */
     struct hash_elem elem;
   };
 
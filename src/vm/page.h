@@ -10,7 +10,9 @@ enum sup_page_type
   {
     SWAP = 1,
     FILE = 2,
-    FILEINSWAP = 3
+    FILEINSWAP = 3,
+    ZERO = 4,           /* Demand-zero page, such as a stack page. */
+    ZEROINSWAP = 5
   };
 
 /* Struct that holds information about a page in the supplementary page table.
@@ -0,0 +1,293 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <stdio.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+
+/* A process that has a shared page mapped. */
+struct sharer
+  {
+    struct thread *thread;      /* Process that has the page mapped. */
+    struct sup_page *page;      /* Its sup_page for the mapping. */
+    struct list_elem elem;      /* Element in shared_page's sharers. */
+  };
+
+/* Page cache of read-only executable pages, keyed by inode, offset and
+   length read. */
+static struct hash page_cache;
+
+/* Protects the page cache and the sharer lists of its entries. Taken
+   before any page directory lock. */
+static struct lock share_lock;
+
+/* Page cache statistics. */
+static struct
+  {
+    long long pages;            /* # of pages added to the cache. */
+    long long hits;             /* # of faults served from the cache. */
+  }
+stats;
+
+static unsigned shared_page_hash (const struct hash_elem *, void *aux);
+static bool shared_page_less (const struct hash_elem *,
+                              const struct hash_elem *, void *aux);
+static struct shared_page *lookup (struct sup_page *);
+static void add_sharer (struct shared_page *, struct sup_page *);
+
+void
+share_init (void)
+{
+  hash_init (&page_cache, shared_page_hash, shared_page_less, NULL);
+  lock_init (&share_lock);
+}
+
+/* If the page that PAGE would read from its executable is already resident
+   on behalf of another process, map that frame read-only at PAGE's address
+   in the current thread and return true. Otherwise return false, and the
+   caller should read the page in and hand it to share_add(). */
+bool
+share_map (struct sup_page *page)
+{
+  struct shared_page *sp;
+
+  ASSERT (page->type == FILE && !page->writable);
+
+  lock_acquire (&share_lock);
+  sp = lookup (page);
+  if (sp != NULL)
+    {
+      add_sharer (sp, page);
+      stats.hits++;
+    }
+  lock_release (&share_lock);
+
+  return sp != NULL;
+}
+
+/* Add KPAGE, which holds the data for PAGE freshly read from its executable,
+   to the page cache and map it read-only at PAGE's address in the current
+   thread. If another process got the same page into the cache first, its
+   frame is mapped instead and false is returned; the caller must then free
+   KPAGE. */
+bool
+share_add (struct sup_page *page, void *kpage)
+{
+  struct shared_page *sp;
+  bool added = false;
+
+  ASSERT (page->type == FILE && !page->writable);
+
+  lock_acquire (&share_lock);
+  sp = lookup (page);
+  if (sp == NULL)
+    {
+      sp = malloc (sizeof *sp);
+      if (sp == NULL)
+        PANIC ("Failed to allocate memory in share_add()");
+
+      sp->inode = file_get_inode (page->file);
+      sp->offset = page->offset;
+      sp->read_bytes = page->read_bytes;
+      sp->kpage = kpage;
+      list_init (&sp->sharers);
+      sp->cached = true;
+      hash_insert (&page_cache, &sp->elem);
+
+      frame_set_share (kpage, sp);
+      stats.pages++;
+      added = true;
+    }
+  else
+    stats.hits++;
+
+  add_sharer (sp, page);
+  lock_release (&share_lock);
+
+  return added;
+}
+
+/* Returns true if any process sharing SP has accessed it since the last
+   call, and clears the accessed bits of all of them. */
+bool
+share_test_and_clear_accessed (struct shared_page *sp)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  lock_acquire (&share_lock);
+  for (e = list_begin (&sp->sharers); e != list_end (&sp->sharers);
+       e = list_next (e))
+    {
+      struct sharer *s = list_entry (e, struct sharer, elem);
+      struct thread *t = s->thread;
+
+      lock_acquire (&t->pd_lock);
+      if (pagedir_is_accessed (t->pagedir, s->page->user_addr))
+        {
+          pagedir_set_accessed (t->pagedir, s->page->user_addr, false);
+          accessed = true;
+        }
+      lock_release (&t->pd_lock);
+    }
+  lock_release (&share_lock);
+
+  return accessed;
+}
+
+/* Unmap SP from every process sharing it, so that its frame can be reused,
+   and free SP. The frame is never dirty, so nothing is written back; the
+   sharers fault the page in again from the executable. The frame must be
+   pinned by the caller. */
+void
+share_evict (struct shared_page *sp)
+{
+  lock_acquire (&share_lock);
+  if (sp->cached)
+    hash_delete (&page_cache, &sp->elem);
+
+  while (!list_empty (&sp->sharers))
+    {
+      struct list_elem *e = list_pop_front (&sp->sharers);
+      struct sharer *s = list_entry (e, struct sharer, elem);
+      struct thread *t = s->thread;
+
+      lock_acquire (&t->pd_lock);
+      pagedir_clear_page (t->pagedir, s->page->user_addr);
+      lock_release (&t->pd_lock);
+
+      s->page->is_loaded = false;
+      free (s);
+    }
+  lock_release (&share_lock);
+
+  free (sp);
+}
+
+/* Unmap every shared page from exiting thread T. Must be called while T's
+   page directory is still in place, before pagedir_destroy(), which would
+   otherwise free frames that other processes still have mapped. A page
+   nobody shares any more leaves the cache, but its frame stays in the frame
+   table until the clock hand reaches it; with no mappings left, it is the
+   first frame to be evicted. */
+void
+share_release (struct thread *t)
+{
+  struct hash_iterator i;
+
+  lock_acquire (&share_lock);
+  hash_first (&i, &t->supp_pt);
+  while (hash_next (&i))
+    {
+      struct sup_page *page = hash_entry (hash_cur (&i), struct sup_page,
+                                          pt_elem);
+      struct shared_page *sp;
+      struct list_elem *e;
+
+      if (page->type != FILE || page->writable || !page->is_loaded)
+        continue;
+
+      sp = lookup (page);
+      if (sp == NULL)
+        continue;
+
+      for (e = list_begin (&sp->sharers); e != list_end (&sp->sharers);
+           e = list_next (e))
+        {
+          struct sharer *s = list_entry (e, struct sharer, elem);
+          if (s->page == page)
+            {
+              list_remove (e);
+              free (s);
+              break;
+            }
+        }
+
+      lock_acquire (&t->pd_lock);
+      pagedir_clear_page (t->pagedir, page->user_addr);
+      lock_release (&t->pd_lock);
+      page->is_loaded = false;
+
+      if (list_empty (&sp->sharers))
+        {
+          hash_delete (&page_cache, &sp->elem);
+          sp->cached = false;
+        }
+    }
+  lock_release (&share_lock);
+}
+
+/* Prints page cache statistics. */
+void
+share_print_stats (void)
+{
+  printf ("Share: %lld pages cached, %lld faults served from the cache\n",
+          stats.pages, stats.hits);
+}
+
+/* Find the cache entry for the data PAGE reads from its executable, or a
+   null pointer if there is none. The share lock must be held. */
+static struct shared_page *
+lookup (struct sup_page *page)
+{
+  struct shared_page temp;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&share_lock));
+
+  temp.inode = file_get_inode (page->file);
+  temp.offset = page->offset;
+  temp.read_bytes = page->read_bytes;
+  e = hash_find (&page_cache, &temp.elem);
+
+  return e != NULL ? hash_entry (e, struct shared_page, elem) : NULL;
+}
+
+/* Map SP read-only at PAGE's address in the current thread and record the
+   current thread as one of its sharers. The share lock must be held. */
+static void
+add_sharer (struct shared_page *sp, struct sup_page *page)
+{
+  struct thread *cur = thread_current ();
+  struct sharer *s = malloc (sizeof *s);
+
+  ASSERT (lock_held_by_current_thread (&share_lock));
+
+  if (s == NULL)
+    PANIC ("Failed to allocate memory in add_sharer()");
+
+  s->thread = cur;
+  s->page = page;
+  list_push_back (&sp->sharers, &s->elem);
+
+  lock_acquire (&cur->pd_lock);
+  pagedir_set_page (cur->pagedir, page->user_addr, sp->kpage, false);
+  lock_release (&cur->pd_lock);
+
+  page->is_loaded = true;
+}
+
+static unsigned
+shared_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct shared_page *sp = hash_entry (e, struct shared_page, elem);
+
+  return (hash_bytes (&sp->inode, sizeof sp->inode) ^ hash_int (sp->offset)
+          ^ hash_int (sp->read_bytes));
+}
+
+static bool
+shared_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct shared_page *a = hash_entry (a_, struct shared_page, elem);
+  const struct shared_page *b = hash_entry (b_, struct shared_page, elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->offset != b->offset)
+    return a->offset < b->offset;
+  return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,34 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
+#include "threads/thread.h"
+#include "vm/page.h"
+
+/* A read-only page of an executable that is resident in a frame and may be
+   mapped by every process running that executable. Entries are found by the
+   inode, offset and length read of the page they hold: two segments may
+   read different lengths from the same offset and zero the rest. */
+struct shared_page
+  {
+    struct inode *inode;        /* Executable the page was read from. */
+    off_t offset;               /* Offset of the page in the executable. */
+    uint32_t read_bytes;        /* Bytes read from there; the rest is zero. */
+    void *kpage;                /* Frame holding the page. */
+    struct list sharers;        /* Processes that have the frame mapped. */
+    bool cached;                /* Is the entry still in the page cache? */
+    struct hash_elem elem;      /* Element in the page cache. */
+  };
+
+void share_init (void);
+bool share_map (struct sup_page *page);
+bool share_add (struct sup_page *page, void *kpage);
+bool share_test_and_clear_accessed (struct shared_page *);
+void share_evict (struct shared_page *);
+void share_release (struct thread *t);
+void share_print_stats (void);
+
+#endif /* vm/share.h */
@@ -2,14 +2,50 @@
 #include "threads/vaddr.h"
 #include "devices/block.h"
 #include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
 #include "threads/synch.h"
 
-/* This is always 2, but for neatness we define it here */
+/* This is always 8, but for neatness we define it here */
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
 static struct block *block_device;
 static struct bitmap *swap_slot_map;
 
+/* Protects the slot map, the buffers below and the statistics. */
+static struct lock swap_lock;
+
+/* Slot to start looking from for the next allocation, so that slots are
+   handed out in ascending order and pages evicted one after the other end
+   up next to each other on disk. */
+static size_t next_slot;
+
+/* Pages are copied into here so that a cluster can be written with a single
+   request. */
+static uint8_t *cluster_buffer;
+
+/* Read-ahead buffer. Holds the contents of slots READ_AHEAD_BASE up to
+   READ_AHEAD_BASE + READ_AHEAD_CNT, which were read in by an earlier swap
+   fault. */
+static uint8_t *read_ahead_buffer;
+static size_t read_ahead_base;
+static size_t read_ahead_cnt;
+
+/* Swap statistics. */
+static struct
+  {
+    long long pages_out;        /* # of pages written to swap. */
+    long long writes;           /* # of write requests. */
+    long long pages_in;         /* # of pages read back in. */
+    long long reads;            /* # of read requests. */
+    long long read_ahead_hits;  /* # of pages found in the read-ahead. */
+  }
+stats;
+
+static size_t allocate_slots (size_t cnt);
+static void invalidate_read_ahead (size_t first, size_t cnt);
+
 void
 init_swap_structures (void)
 {
@@ -23,44 +59,125 @@ init_swap_structures (void)
   if ((swap_slot_map = bitmap_create (size)) == NULL)
       PANIC ("Could not allocate memory for swap table");
 
+  lock_init (&swap_lock);
+  cluster_buffer = palloc_get_multiple (PAL_ASSERT, SWAP_CLUSTER);
+  read_ahead_buffer = palloc_get_multiple (PAL_ASSERT, SWAP_CLUSTER);
 }
 
-size_t
-pick_slot_and_swap (void *page)
+/* Write the CNT pages in PAGES to swap, storing the slot each one went to
+   in SLOTS. If there is a run of CNT free slots, the pages go there with a
+   single request; otherwise each is written to whichever slot is free.
+   Returns false if swap is full. */
+bool
+pick_slots_and_swap (void **pages, size_t cnt, size_t *slots)
 {
-  /* Finds the first slot which has value false (so it's free) and flips it,
-     returning the index */
-  size_t index = bitmap_scan_and_flip (swap_slot_map, 0, 1, false);
-
-  /* Write the ith BLOCK_SECTOR_SIZE bytes of the page to the block device. We
-     have a mapping of SECTORS_PER_PAGE block sectors for every bit in the
-     bitmap, so we can just multiply the index we got back by SECTORS_PER_PAGE
-     to find the correct block sector to write to, and then increment this
-     block sector index in each loop iteration */
-  int i = 0;
-  for (; i < SECTORS_PER_PAGE; ++i)
+  size_t i;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  if (cnt == 0)
+    return true;
+
+  lock_acquire (&swap_lock);
+
+  /* Finds CNT adjacent slots which have value false (so they're free) and
+     flips them, returning the index of the first */
+  size_t first = allocate_slots (cnt);
+  if (first != BITMAP_ERROR)
     {
-      block_write (block_device, (index * SECTORS_PER_PAGE) + i,
-                   page + (BLOCK_SECTOR_SIZE * i));
+      void *buffer = pages[0];
+
+      /* We have a mapping of SECTORS_PER_PAGE block sectors for every bit
+         in the bitmap, so the cluster starts at sector first *
+         SECTORS_PER_PAGE */
+      if (cnt > 1)
+        {
+          for (i = 0; i < cnt; ++i)
+            memcpy (cluster_buffer + i * PGSIZE, pages[i], PGSIZE);
+          buffer = cluster_buffer;
+        }
+
+      invalidate_read_ahead (first, cnt);
+      block_write_multiple (block_device, first * SECTORS_PER_PAGE,
+                            cnt * SECTORS_PER_PAGE, buffer);
+      stats.writes++;
+
+      for (i = 0; i < cnt; ++i)
+        slots[i] = first + i;
     }
-  return index;
+  else
+    {
+      /* Swap is too fragmented for a cluster, so write the pages one by
+         one */
+      for (i = 0; i < cnt; ++i)
+        {
+          slots[i] = allocate_slots (1);
+          if (slots[i] == BITMAP_ERROR)
+            {
+              /* Out of swap. Give back what we took */
+              while (i-- > 0)
+                bitmap_reset (swap_slot_map, slots[i]);
+              lock_release (&swap_lock);
+              return false;
+            }
+
+          invalidate_read_ahead (slots[i], 1);
+          block_write_multiple (block_device, slots[i] * SECTORS_PER_PAGE,
+                                SECTORS_PER_PAGE, pages[i]);
+          stats.writes++;
+        }
+    }
+
+  stats.pages_out += cnt;
+  lock_release (&swap_lock);
+  return true;
 }
 
+/* Read the page in slot INDEX into PAGE and mark the slot free again. The
+   other in-use slots in the same cluster of SWAP_CLUSTER slots are read in
+   with it, in the same request, since they were most likely evicted
+   together and will be faulted back in together. A later call for one of
+   them is then served without going to disk. */
 void
 free_slot (void *page, size_t index)
 {
-  /* Mark the slot as free again */
+  lock_acquire (&swap_lock);
+
   ASSERT (bitmap_test (swap_slot_map, index));
-  bitmap_flip (swap_slot_map, index);
 
-  /* This is almost identical to the loop in pick_slot_and_swap, we're just
-     going the other way */
-  int i = 0;
-  for (; i < SECTORS_PER_PAGE; ++i)
+  if (index >= read_ahead_base && index < read_ahead_base + read_ahead_cnt)
+    stats.read_ahead_hits++;
+  else
     {
-      block_read (block_device, (index * SECTORS_PER_PAGE) + i,
-                   page + (BLOCK_SECTOR_SIZE * i));
+      /* Find the run of in-use slots around INDEX, without leaving its
+         cluster */
+      size_t cluster = index - index % SWAP_CLUSTER;
+      size_t end = cluster + SWAP_CLUSTER;
+      size_t lo = index;
+      size_t hi = index + 1;
+
+      if (end > bitmap_size (swap_slot_map))
+        end = bitmap_size (swap_slot_map);
+      while (lo > cluster && bitmap_test (swap_slot_map, lo - 1))
+        lo--;
+      while (hi < end && bitmap_test (swap_slot_map, hi))
+        hi++;
+
+      block_read_multiple (block_device, lo * SECTORS_PER_PAGE,
+                           (hi - lo) * SECTORS_PER_PAGE, read_ahead_buffer);
+      read_ahead_base = lo;
+      read_ahead_cnt = hi - lo;
+      stats.reads++;
     }
+
+  memcpy (page, read_ahead_buffer + (index - read_ahead_base) * PGSIZE,
+          PGSIZE);
+
+  /* Mark the slot as free again */
+  bitmap_reset (swap_slot_map, index);
+  stats.pages_in++;
+
+  lock_release (&swap_lock);
 }
 
 void
@@ -68,3 +185,39 @@ destroy_swap_map (void)
 {
   bitmap_destroy (swap_slot_map);
 }
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %lld pages out in %lld writes, "
+          "%lld pages in in %lld reads (%lld read ahead)\n",
+          stats.pages_out, stats.writes, stats.pages_in, stats.reads,
+          stats.read_ahead_hits);
+}
+
+/* Allocate CNT adjacent free slots, starting the search where the last
+   allocation left off and wrapping round to the start of swap. Returns the
+   index of the first slot, or BITMAP_ERROR if there is no such run. The
+   swap lock must be held. */
+static size_t
+allocate_slots (size_t cnt)
+{
+  size_t first = bitmap_scan_and_flip (swap_slot_map, next_slot, cnt, false);
+  if (first == BITMAP_ERROR && next_slot != 0)
+    first = bitmap_scan_and_flip (swap_slot_map, 0, cnt, false);
+
+  if (first != BITMAP_ERROR)
+    next_slot = first + cnt;
+  return first;
+}
+
+/* Forget any read-ahead data for the CNT slots starting at FIRST, which are
+   about to be overwritten. The swap lock must be held. */
+static void
+invalidate_read_ahead (size_t first, size_t cnt)
+{
+  if (first < read_ahead_base + read_ahead_cnt
+      && read_ahead_base < first + cnt)
+    read_ahead_cnt = 0;
+}
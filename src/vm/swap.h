@@ -1,11 +1,17 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+/* Most pages that are swapped out, or read back in, with one disk
+   request. */
+#define SWAP_CLUSTER 8
+
 void init_swap_structures (void);
-size_t pick_slot_and_swap (void *page);
+bool pick_slots_and_swap (void **pages, size_t cnt, size_t *slots);
 void free_slot (void *page, size_t index);
 void destroy_swap_map (void);
+void swap_print_stats (void);
 
 #endif